@@ -0,0 +1,728 @@
+// ==============================================================================
+/**
+ * bench.c
+ *
+ * Microbenchmarks for the allocators.  Each benchmark is deterministic (every
+ * thread draws its sizes from its own fixed seed), and uses only the standard
+ * allocation functions, so that the same binary measures any allocator
+ * preloaded beneath it:
+ *
+ *     LD_PRELOAD=./libsf.so ./bench [-n <ops>] [-t <threads>] [<benchmark>...]
+ *
+ * `make benchmark` runs every benchmark against glibc and each of the
+ * allocators in turn.  Each result is printed as a line of tab-separated
+ * fields:
+ *
+ *     benchmark  parameter  value  unit
+ *
+ * The benchmarks are:
+ *
+ *   - `single`:   a single thread's `malloc()`/`free()` pairs, of one size and
+ *                 of mixed sizes, and of a batch of blocks freed in order.
+ *   - `scaling`:  threads (1, 2, 4, ..., up to `-t`) each replacing blocks at
+ *                 random in a private working set.
+ *   - `prodcons`: one thread allocates, and another frees.
+ *   - `realloc`:  chains of blocks grown by `realloc()` to 1 MB.
+ *   - `larson`:   as in Larson and Krishnan: threads replace blocks at random,
+ *                 and then hand their working sets on to newer threads.
+ *   - `xmalloc`:  as in `xmalloc-test`: producers allocate batches of blocks,
+ *                 and consumers free them.
+ *   - `latency`:  the distribution of the time taken by single calls.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS AND FUNCTIONS
+
+/** The default number of operations per benchmark (and per thread). */
+#define DEFAULT_OPS 1000000
+
+/** The most threads that any benchmark will run. */
+#define MAX_THREADS 256
+
+/** The number of blocks that each thread keeps live in the random workloads. */
+#define WORKING_SET 1024
+
+/** The number of slots in the producer/consumer ring. */
+#define RING_SLOTS 1024
+
+/** The number of blocks in each batch passed from a producer to a consumer. */
+#define XMALLOC_BATCH 256
+
+/** The number of rounds of thread hand-off in the Larson benchmark. */
+#define LARSON_ROUNDS 8
+
+/** The size to which each realloc chain grows. */
+#define REALLOC_MAX_SIZE (1 << 20)
+
+/** The latency histogram has one bucket per nanosecond, up to this many. */
+#define LATENCY_BUCKETS (1 << 16)
+// ==============================================================================
+
+
+
+// ==============================================================================
+// TYPES AND STRUCTURES
+
+/** A benchmark. */
+typedef struct benchmark {
+
+  /** Its name, as given on the command line. */
+  const char* name;
+
+  /** Run it, and print its results. */
+  void (*run) (void);
+
+} benchmark_s;
+
+/** The work of one thread in the random-replacement workloads. */
+typedef struct worker {
+
+  /** The thread's seed. */
+  uint64_t seed;
+
+  /** Its working set of blocks. */
+  void** blocks;
+
+  /** The number of blocks to replace. */
+  size_t replacements;
+
+} worker_s;
+
+/** A batch of blocks passed between threads in the xmalloc benchmark. */
+typedef struct batch {
+
+  void*         blocks[XMALLOC_BATCH];
+  struct batch* next;
+
+} batch_s;
+// ==============================================================================
+
+
+
+// ==============================================================================
+// GLOBALS
+
+/** The number of operations to run per benchmark. */
+static size_t ops = DEFAULT_OPS;
+
+/** The most threads to run. */
+static int max_threads = 0;
+
+/** The producer/consumer ring, and whether the producer is done. */
+static void* volatile ring[RING_SLOTS];
+static volatile bool  producer_done;
+
+/** Full batches awaiting a consumer, and the number of producers still busy. */
+static batch_s*        batches = NULL;
+static int             producers_left;
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  batch_ready = PTHREAD_COND_INITIALIZER;
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The current time.
+ *
+ * \return The monotonic time, in nanoseconds.
+ */
+static inline uint64_t now_ns () {
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+
+} // now_ns ()
+
+/**
+ * The next of a sequence of pseudo-random numbers (xorshift64*).
+ *
+ * \param state The state of the sequence, which must not be zero.
+ * \return      The next number.
+ */
+static inline uint64_t next_random (uint64_t* state) {
+
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * UINT64_C(2685821657736338717);
+
+} // next_random ()
+
+/**
+ * A size drawn from a mix typical of real programs: mostly small blocks, some
+ * medium ones, and a few large ones.
+ *
+ * \param state The state of the random sequence.
+ * \return      The size, in bytes.
+ */
+static inline size_t random_size (uint64_t* state) {
+
+  uint64_t r    = next_random(state);
+  unsigned pick = r % 100;
+  r >>= 8;
+  if (pick < 80) {
+    return 16 + r % 112;
+  } else if (pick < 95) {
+    return 128 + r % 1920;
+  } else {
+    return 2048 + r % 30720;
+  }
+
+} // random_size ()
+
+/** Print one result. */
+static void report (const char* benchmark, const char* parameter, double value, const char* unit) {
+  printf("%s\t%s\t%.1f\t%s\n", benchmark, parameter, value, unit);
+} // report ()
+
+/**
+ * Run a function on a number of threads at once, and time them.
+ *
+ * \param count   The number of threads.
+ * \param routine The function.
+ * \param args    The argument of each thread.
+ * \param size    The size of each argument.
+ * \return        The nanoseconds from the first thread's start to the last's
+ *                end.
+ */
+static uint64_t run_threads (int count, void* (*routine) (void*), void* args, size_t size) {
+
+  pthread_t threads[MAX_THREADS];
+  uint64_t  start = now_ns();
+  for (int i = 0; i < count; ++i) {
+    if (pthread_create(&threads[i], NULL, routine, (char*)args + i * size) != 0) {
+      perror("pthread_create");
+      exit(1);
+    }
+  }
+  for (int i = 0; i < count; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+  return now_ns() - start;
+
+} // run_threads ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Single-threaded pairs of `malloc()` and `free()`: repeatedly of one small
+ * size, then of mixed sizes, and then of a batch of blocks allocated at once
+ * and freed in the order allocated.
+ */
+static void bench_single () {
+
+  uint64_t start = now_ns();
+  for (size_t i = 0; i < ops; ++i) {
+    void* block = malloc(64);
+    __asm__ volatile ("" : : "r" (block) : "memory");
+    free(block);
+  }
+  report("single", "pair/64", (double)(now_ns() - start) / ops, "ns/pair");
+
+  uint64_t seed = 1;
+  start = now_ns();
+  for (size_t i = 0; i < ops; ++i) {
+    void* block = malloc(random_size(&seed));
+    __asm__ volatile ("" : : "r" (block) : "memory");
+    free(block);
+  }
+  report("single", "pair/mixed", (double)(now_ns() - start) / ops, "ns/pair");
+
+  void* blocks[WORKING_SET];
+  seed  = 1;
+  start = now_ns();
+  for (size_t done = 0; done < ops; done += WORKING_SET) {
+    for (int i = 0; i < WORKING_SET; ++i) {
+      blocks[i] = malloc(random_size(&seed));
+    }
+    for (int i = 0; i < WORKING_SET; ++i) {
+      free(blocks[i]);
+    }
+  }
+  size_t pairs = (ops + WORKING_SET - 1) / WORKING_SET * WORKING_SET;
+  report("single", "batch/mixed", (double)(now_ns() - start) / pairs, "ns/pair");
+
+} // bench_single ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Replace blocks of a thread's working set at random.  The working set is filled first if it is empty, and left full.
+ *
+ * \param arg The thread's work.
+ */
+static void* replace_blocks (void* arg) {
+
+  worker_s* worker = (worker_s*)arg;
+  for (int i = 0; i < WORKING_SET; ++i) {
+    if (worker->blocks[i] == NULL) {
+      worker->blocks[i] = malloc(random_size(&worker->seed));
+    }
+  }
+  for (size_t i = 0; i < worker->replacements; ++i) {
+    uint64_t r    = next_random(&worker->seed);
+    int      slot = r % WORKING_SET;
+    free(worker->blocks[slot]);
+    size_t size = random_size(&worker->seed);
+    worker->blocks[slot] = malloc(size);
+    *(char*)worker->blocks[slot] = (char)size;
+  }
+  return NULL;
+
+} // replace_blocks ()
+
+/** Make a thread's work, with an empty working set. */
+static void worker_init (worker_s* worker, int index) {
+
+  worker->seed         = index + 1;
+  worker->blocks       = calloc(WORKING_SET, sizeof(void*));
+  worker->replacements = ops;
+  if (worker->blocks == NULL) {
+    perror("calloc");
+    exit(1);
+  }
+
+} // worker_init ()
+
+/** Free a thread's working set. */
+static void worker_destroy (worker_s* worker) {
+
+  for (int i = 0; i < WORKING_SET; ++i) {
+    free(worker->blocks[i]);
+  }
+  free(worker->blocks);
+
+} // worker_destroy ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Threads, each replacing blocks at random in its own working set, for 1, 2,
+ * 4, ... threads, up to the most allowed.  Perfect scaling keeps the time per
+ * operation constant as threads are added.
+ */
+static void bench_scaling () {
+
+  worker_s workers[MAX_THREADS];
+  for (int count = 1; count <= max_threads; count = (count < max_threads && count * 2 > max_threads ?
+						      max_threads :
+						      count * 2)) {
+    for (int i = 0; i < count; ++i) {
+      worker_init(&workers[i], i);
+    }
+    uint64_t elapsed = run_threads(count, replace_blocks, workers, sizeof(worker_s));
+    for (int i = 0; i < count; ++i) {
+      worker_destroy(&workers[i]);
+    }
+
+    char parameter[32];
+    snprintf(parameter, sizeof(parameter), "threads/%d", count);
+    report("scaling", parameter, (double)ops * count / elapsed * 1000, "Mops/s");
+  }
+
+} // bench_scaling ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/** The producer: allocate blocks, and pass each to the consumer by the ring. */
+static void* produce (void* arg) {
+
+  uint64_t seed = 1;
+  for (size_t i = 0; i < ops; ++i) {
+    void* volatile* slot = &ring[i % RING_SLOTS];
+    while (__atomic_load_n(slot, __ATOMIC_ACQUIRE) != NULL) {
+      sched_yield();
+    }
+    size_t size  = random_size(&seed);
+    char*  block = malloc(size);
+    block[0] = (char)size;
+    __atomic_store_n(slot, block, __ATOMIC_RELEASE);
+  }
+  __atomic_store_n(&producer_done, true, __ATOMIC_RELEASE);
+  return NULL;
+
+} // produce ()
+
+/** The consumer: free each block that the producer passes along. */
+static void* consume (void* arg) {
+
+  for (size_t i = 0; i < ops; ++i) {
+    void* volatile* slot = &ring[i % RING_SLOTS];
+    void*           block;
+    while ((block = __atomic_exchange_n(slot, NULL, __ATOMIC_ACQUIRE)) == NULL) {
+      sched_yield();
+    }
+    free(block);
+  }
+  return NULL;
+
+} // consume ()
+
+/** One thread allocates blocks, and another frees them. */
+static void bench_prodcons () {
+
+  memset((void*)ring, 0, sizeof(ring));
+  producer_done = false;
+
+  pthread_t producer;
+  pthread_t consumer;
+  uint64_t  start = now_ns();
+  pthread_create(&producer, NULL, produce, NULL);
+  pthread_create(&consumer, NULL, consume, NULL);
+  pthread_join(producer, NULL);
+  pthread_join(consumer, NULL);
+  report("prodcons", "threads/2", (double)(now_ns() - start) / ops, "ns/block");
+
+} // bench_prodcons ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Chains of reallocation: grow a block, by half again each time, from 16 bytes
+ * to 1 MB, writing to its end at each step.
+ */
+static void bench_realloc () {
+
+  size_t   steps = 0;
+  uint64_t start = now_ns();
+  for (size_t chain = 0; steps < ops; ++chain) {
+    char* block = NULL;
+    for (size_t size = 16; size <= REALLOC_MAX_SIZE; size += size / 2) {
+      block = realloc(block, size);
+      block[size - 1] = (char)chain;
+      steps += 1;
+    }
+    free(block);
+  }
+  report("realloc", "chain/1MB", (double)(now_ns() - start) / steps, "ns/realloc");
+
+} // bench_realloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Larson and Krishnan's server workload: threads replace blocks at random, and
+ * at the end of each round, each thread's working set passes to a newly created
+ * thread, which frees blocks that an exited thread allocated.
+ */
+static void bench_larson () {
+
+  size_t   per_round = ops / LARSON_ROUNDS;
+  worker_s workers[MAX_THREADS];
+  for (int i = 0; i < max_threads; ++i) {
+    worker_init(&workers[i], i);
+    workers[i].replacements = per_round;
+  }
+
+  uint64_t elapsed = 0;
+  for (int round = 0; round < LARSON_ROUNDS; ++round) {
+    elapsed += run_threads(max_threads, replace_blocks, workers, sizeof(worker_s));
+
+    // Hand each working set on to the next thread.
+    void** first = workers[0].blocks;
+    for (int i = 0; i + 1 < max_threads; ++i) {
+      workers[i].blocks = workers[i + 1].blocks;
+    }
+    workers[max_threads - 1].blocks = first;
+  }
+
+  for (int i = 0; i < max_threads; ++i) {
+    worker_destroy(&workers[i]);
+  }
+  char parameter[32];
+  snprintf(parameter, sizeof(parameter), "threads/%d", max_threads);
+  report("larson", parameter,
+	 (double)per_round * LARSON_ROUNDS * max_threads / elapsed * 1000, "Mops/s");
+
+} // bench_larson ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/** An xmalloc producer: allocate batches of blocks, and queue them. */
+static void* xmalloc_produce (void* arg) {
+
+  uint64_t seed = (uintptr_t)arg;
+  for (size_t done = 0; done < ops; done += XMALLOC_BATCH) {
+    batch_s* batch = malloc(sizeof(batch_s));
+    for (int i = 0; i < XMALLOC_BATCH; ++i) {
+      batch->blocks[i] = malloc(random_size(&seed));
+    }
+    pthread_mutex_lock(&batch_lock);
+    batch->next = batches;
+    batches     = batch;
+    pthread_cond_signal(&batch_ready);
+    pthread_mutex_unlock(&batch_lock);
+  }
+
+  pthread_mutex_lock(&batch_lock);
+  producers_left -= 1;
+  pthread_cond_broadcast(&batch_ready);
+  pthread_mutex_unlock(&batch_lock);
+  return NULL;
+
+} // xmalloc_produce ()
+
+/** An xmalloc consumer: free queued batches, until the producers are done. */
+static void* xmalloc_consume (void* arg) {
+
+  while (true) {
+    pthread_mutex_lock(&batch_lock);
+    while (batches == NULL && producers_left > 0) {
+      pthread_cond_wait(&batch_ready, &batch_lock);
+    }
+    batch_s* batch = batches;
+    if (batch != NULL) {
+      batches = batch->next;
+    }
+    pthread_mutex_unlock(&batch_lock);
+    if (batch == NULL) {
+      return NULL;
+    }
+    for (int i = 0; i < XMALLOC_BATCH; ++i) {
+      free(batch->blocks[i]);
+    }
+    free(batch);
+  }
+
+} // xmalloc_consume ()
+
+/** Half of the threads allocate, and the other half free what they allocate. */
+static void* xmalloc_thread (void* arg) {
+
+  uintptr_t index = (uintptr_t)*(void**)arg;
+  return (index % 2 == 0 ? xmalloc_produce((void*)(index + 1)) : xmalloc_consume(NULL));
+
+} // xmalloc_thread ()
+
+/** The xmalloc-test workload: producers allocate, and consumers free. */
+static void bench_xmalloc () {
+
+  int   count = (max_threads < 2 ? 2 : max_threads & ~1);
+  void* args[MAX_THREADS];
+  for (int i = 0; i < count; ++i) {
+    args[i] = (void*)(uintptr_t)i;
+  }
+  producers_left = count / 2;
+
+  uint64_t elapsed = run_threads(count, xmalloc_thread, args, sizeof(void*));
+  size_t   blocks  = (ops + XMALLOC_BATCH - 1) / XMALLOC_BATCH * XMALLOC_BATCH * (count / 2);
+
+  char parameter[32];
+  snprintf(parameter, sizeof(parameter), "threads/%d", count);
+  report("xmalloc", parameter, (double)blocks / elapsed * 1000, "Mblocks/s");
+
+} // bench_xmalloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Report percentiles of a latency histogram.
+ *
+ * \param name      The operation measured.
+ * \param histogram The count of calls taking each number of nanoseconds.
+ * \param total     The number of calls.
+ */
+static void report_latency (const char* name, uint64_t* histogram, size_t total) {
+
+  static const struct { const char* label; double fraction; } marks[] = {
+    { "p50",  0.50  },
+    { "p99",  0.99  },
+    { "p999", 0.999 },
+  };
+
+  char   parameter[32];
+  size_t seen = 0;
+  int    mark = 0;
+  for (int bucket = 0; bucket < LATENCY_BUCKETS && mark < 3; ++bucket) {
+    seen += histogram[bucket];
+    while (mark < 3 && seen >= marks[mark].fraction * total) {
+      snprintf(parameter, sizeof(parameter), "%s/%s", name, marks[mark].label);
+      report("latency", parameter, bucket, "ns");
+      mark += 1;
+    }
+  }
+  int highest = LATENCY_BUCKETS - 1;
+  while (highest > 0 && histogram[highest] == 0) {
+    highest -= 1;
+  }
+  snprintf(parameter, sizeof(parameter), "%s/max%s", name,
+	   highest == LATENCY_BUCKETS - 1 ? "+" : "");
+  report("latency", parameter, highest, "ns");
+
+} // report_latency ()
+
+/**
+ * The distribution of the time taken by single calls to `malloc()` and to
+ * `free()`, replacing blocks at random in a working set.  The cost of reading
+ * the clock is measured, and taken off of each call.  The histograms are
+ * mapped, rather than allocated, so as not to disturb the heap under test.
+ */
+static void bench_latency () {
+
+  size_t    length     = 2 * LATENCY_BUCKETS * sizeof(uint64_t);
+  uint64_t* histograms = mmap(NULL, length, PROT_READ | PROT_WRITE,
+			      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (histograms == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  uint64_t* malloc_histogram = histograms;
+  uint64_t* free_histogram   = histograms + LATENCY_BUCKETS;
+
+  uint64_t overhead = UINT64_MAX;
+  for (int i = 0; i < 1000; ++i) {
+    uint64_t before = now_ns();
+    uint64_t after  = now_ns();
+    overhead = (after - before < overhead ? after - before : overhead);
+  }
+
+  void*    blocks[WORKING_SET];
+  uint64_t seed = 1;
+  for (int i = 0; i < WORKING_SET; ++i) {
+    blocks[i] = malloc(random_size(&seed));
+  }
+  for (size_t i = 0; i < ops; ++i) {
+    int    slot = next_random(&seed) % WORKING_SET;
+    size_t size = random_size(&seed);
+
+    uint64_t before = now_ns();
+    free(blocks[slot]);
+    uint64_t middle = now_ns();
+    blocks[slot] = malloc(size);
+    uint64_t after  = now_ns();
+
+    uint64_t free_ns   = middle - before - overhead;
+    uint64_t malloc_ns = after - middle - overhead;
+    free_histogram[free_ns < LATENCY_BUCKETS ? free_ns : LATENCY_BUCKETS - 1]       += 1;
+    malloc_histogram[malloc_ns < LATENCY_BUCKETS ? malloc_ns : LATENCY_BUCKETS - 1] += 1;
+  }
+  for (int i = 0; i < WORKING_SET; ++i) {
+    free(blocks[i]);
+  }
+
+  report_latency("malloc", malloc_histogram, ops);
+  report_latency("free",   free_histogram,   ops);
+  munmap(histograms, length);
+
+} // bench_latency ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/** Every benchmark, in the order run. */
+static const benchmark_s benchmarks[] = {
+  { "single",   bench_single   },
+  { "scaling",  bench_scaling  },
+  { "prodcons", bench_prodcons },
+  { "realloc",  bench_realloc  },
+  { "larson",   bench_larson   },
+  { "xmalloc",  bench_xmalloc  },
+  { "latency",  bench_latency  },
+};
+#define NUM_BENCHMARKS (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+/**
+ * Run the benchmarks.
+ *
+ * \param argc The number of arguments.
+ * \param argv The arguments: optionally, `-n` and the operations per
+ *             benchmark, `-t` and the most threads, and then the names of the
+ *             benchmarks to run (by default, all of them).
+ * \return     `0` if successful; `1` if the arguments are invalid.
+ */
+int main (int argc, char** argv) {
+
+  int option;
+  while ((option = getopt(argc, argv, "n:t:")) != -1) {
+    switch (option) {
+    case 'n':
+      ops = strtoull(optarg, NULL, 10);
+      break;
+    case 't':
+      max_threads = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "USAGE: %s [-n <ops>] [-t <threads>] [<benchmark>...]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (ops == 0) {
+    ops = DEFAULT_OPS;
+  }
+
+  // By default, run up to one thread per processor, but at least four, so that
+  // contention shows even on small machines.
+  if (max_threads <= 0) {
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    max_threads = (processors < 4 ? 4 : (int)processors);
+  }
+  if (max_threads > MAX_THREADS) {
+    max_threads = MAX_THREADS;
+  }
+
+  // Check every name before running anything.
+  for (int arg = optind; arg < argc; ++arg) {
+    bool known = false;
+    for (size_t i = 0; i < NUM_BENCHMARKS; ++i) {
+      known = known || strcmp(argv[arg], benchmarks[i].name) == 0;
+    }
+    if (!known) {
+      fprintf(stderr, "%s: unknown benchmark %s\n", argv[0], argv[arg]);
+      return 1;
+    }
+  }
+
+  for (size_t i = 0; i < NUM_BENCHMARKS; ++i) {
+    bool chosen = (optind == argc);
+    for (int arg = optind; arg < argc; ++arg) {
+      chosen = chosen || strcmp(argv[arg], benchmarks[i].name) == 0;
+    }
+    if (chosen) {
+      benchmarks[i].run();
+      fflush(stdout);
+    }
+  }
+  return 0;
+
+} // main ()
+// ==============================================================================
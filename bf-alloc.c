@@ -0,0 +1,1218 @@
+// ==============================================================================
+/**
+ * bf-alloc.c
+ *
+ * A _best-fit_ heap allocator.  This allocator *does re-use* freed blocks.
+ * Free blocks are kept on a doubly linked free list, and each allocation takes
+ * the smallest free block that fits, splitting off whatever is left over.
+ * Every block carries a _boundary tag_ (a copy of its header at its end), so
+ * that a freed block can be coalesced with its free neighbors.  Only when no
+ * free block fits is the heap expanded, via _pointer bumping_.
+ *
+ * Pages that stay free are eventually returned to the kernel: every _decay
+ * interval_, the free list is swept, and the interior pages of any free block
+ * that has survived a whole interval are released with `madvise()`.  A
+ * background thread sweeps whenever an interval passes without a `free()` to
+ * trigger one, so that a process left idle after a spike still gives back its
+ * memory.
+ *
+ * The heap survives `fork()`: handlers registered as the library loads hold
+ * the heap lock across the fork, so that the child never inherits it held.
+ * No entry point is async-signal-safe, since each takes the heap lock.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "free-sized.h"
+#include "pb-batch.h"
+#include "safeio.h"
+#include "trace.h"
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS AND FUNCTIONS
+
+/** The system's page size. */
+#define PAGE_SIZE sysconf(_SC_PAGESIZE)
+
+/**
+ * Macros to easily calculate the number of bytes for larger scales (e.g., kilo,
+ * mega, gigabytes).
+ */
+#define KB(size)  ((size_t)size * 1024)
+#define MB(size)  (KB(size) * 1024)
+#define GB(size)  (MB(size) * 1024)
+
+/** The virtual address space reserved for the heap. */
+#define HEAP_SIZE GB(2)
+
+/** The alignment of every block returned by `malloc()`. */
+#define ALIGNMENT 16
+
+/** Round `value` up to the next multiple of `ALIGNMENT`. */
+#define ALIGN_UP(value) (((value) + (ALIGNMENT - 1)) & ~((size_t)ALIGNMENT - 1))
+
+/** Whether `value` is a power of two. */
+#define IS_POWER_OF_TWO(value) ((value) != 0 && ((value) & ((value) - 1)) == 0)
+
+/** The bit of a block's size word that marks the block as allocated. */
+#define ALLOCATED_BIT ((size_t)1)
+
+/**
+ * The bits of a free block's size word that record its decay: _aged_ once it
+ * has been seen free by one sweep, and _purged_ once its interior pages have
+ * been returned to the kernel.  Only the header carries them, never the
+ * boundary tag.
+ */
+#define AGED_BIT      ((size_t)2)
+#define PURGED_BIT    ((size_t)4)
+#define DECAY_BITS    (AGED_BIT | PURGED_BIT)
+
+/** All of the flag bits of a size word. */
+#define FLAG_BITS     (ALLOCATED_BIT | AGED_BIT | PURGED_BIT)
+
+/** The bytes of a header that precede the block's usable space. */
+#define HEADER_SIZE offsetof(header_s, next)
+
+/** The bytes of each block taken by the boundary tag at its end. */
+#define FOOTER_SIZE sizeof(size_t)
+
+/**
+ * The smallest whole block: a header with its free-list links, plus a boundary
+ * tag.  Any smaller remainder is not worth splitting off.
+ */
+#define MIN_BLOCK_SIZE ALIGN_UP(sizeof(header_s) + FOOTER_SIZE)
+
+/**
+ * The decay interval, in milliseconds, between sweeps of the free list.  A page
+ * is purged one to two intervals after it becomes free.  Set by the
+ * `PB_DIRTY_DECAY_MS` environment variable; `0` disables purging.  A sweep is
+ * also triggered early once `SWEEP_THRESHOLD` bytes have been freed since the
+ * last one, so that a burst of frees decays sooner.
+ */
+#define DECAY_ENV        "PB_DIRTY_DECAY_MS"
+#define DEFAULT_DECAY_MS 10000
+#define SWEEP_THRESHOLD  MB(64)
+// ==============================================================================
+
+
+
+// ==============================================================================
+// TYPES AND STRUCTURES
+
+/**
+ * A header for each block's metadata.  Only the size word is kept for an
+ * allocated block; the free-list links overlap the start of its usable space,
+ * and so are valid only while the block is free.
+ */
+typedef struct header {
+
+  /**
+   * The size of the whole block (header, usable space, and boundary tag), in
+   * bytes.  Always a multiple of `ALIGNMENT`, leaving the low bits free to mark
+   * the block as allocated, and to record the decay of a free block.
+   */
+  size_t size;
+
+  /** The next block on the free list. */
+  struct header* next;
+
+  /** The previous block on the free list. */
+  struct header* prev;
+
+} header_s;
+// ==============================================================================
+
+
+
+// ==============================================================================
+// GLOBALS
+
+/** The address of the next available byte in the heap region. */
+static intptr_t free_addr  = 0;
+
+/** The beginning of the heap. */
+static intptr_t start_addr = 0;
+
+/** The end of the heap. */
+static intptr_t end_addr   = 0;
+
+/** The head of the free list. */
+static header_s* free_list = NULL;
+
+/** Serializes every operation on the heap and the free list. */
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** The decay interval, in milliseconds. */
+static long decay_ms = DEFAULT_DECAY_MS;
+
+/** The time of the last sweep, in milliseconds. */
+static long last_sweep_ms = 0;
+
+/** The number of bytes freed since the last sweep. */
+static size_t freed_since_sweep = 0;
+
+/** The furthest that the free pointer has ever reached. */
+static intptr_t high_addr = 0;
+// ==============================================================================
+
+
+
+// ==============================================================================
+// BLOCK AND FREE LIST FUNCTIONS
+
+/** The size of the whole block. */
+static inline size_t block_size (header_s* header_ptr) {
+  return header_ptr->size & ~FLAG_BITS;
+}
+
+/** Whether the block is allocated. */
+static inline bool is_allocated (header_s* header_ptr) {
+  return (header_ptr->size & ALLOCATED_BIT) != 0;
+}
+
+/** The usable space of a block. */
+static inline void* block_of (header_s* header_ptr) {
+  return (void*)((intptr_t)header_ptr + HEADER_SIZE);
+}
+
+/** The header of the block whose usable space begins at `ptr`. */
+static inline header_s* header_of (void* ptr) {
+  return (header_s*)((intptr_t)ptr - HEADER_SIZE);
+}
+
+/** The block that immediately follows this one in the heap. */
+static inline header_s* next_block (header_s* header_ptr) {
+  return (header_s*)((intptr_t)header_ptr + block_size(header_ptr));
+}
+
+/**
+ * The block that immediately precedes this one in the heap, found via that
+ * block's boundary tag.  Must not be called on the first block.
+ */
+static inline header_s* prev_block (header_s* header_ptr) {
+  size_t prev_tag = *(size_t*)((intptr_t)header_ptr - FOOTER_SIZE);
+  return (header_s*)((intptr_t)header_ptr - (prev_tag & ~FLAG_BITS));
+}
+
+/**
+ * Set both the header and the boundary tag of a block, clearing any record of
+ * its decay.
+ */
+static inline void set_block (header_s* header_ptr, size_t size, bool allocated) {
+  size_t tag = size | (allocated ? ALLOCATED_BIT : 0);
+  header_ptr->size = tag;
+  *(size_t*)((intptr_t)header_ptr + size - FOOTER_SIZE) = tag;
+}
+
+/**
+ * The record of decay for a free block merged from two others.  The larger
+ * part's record is kept, so that a small block freed beside a large span does
+ * not restart that span's aging.  But if the larger part was purged, and the
+ * smaller was not, then the merged block is only aged, so that the next sweep
+ * purges the newly freed pages, too.
+ *
+ * \param first       The record of one part.
+ * \param first_size  The size of that part.
+ * \param second      The record of the other part.
+ * \param second_size The size of that part.
+ * \return            The record of the merged block.
+ */
+static inline size_t merged_decay (size_t first, size_t first_size, size_t second, size_t second_size) {
+
+  size_t larger  = (first_size >= second_size ? first  : second);
+  size_t smaller = (first_size >= second_size ? second : first);
+  if ((larger & PURGED_BIT) && !(smaller & PURGED_BIT)) {
+    return AGED_BIT;
+  }
+  return larger;
+
+} // merged_decay ()
+
+/** Push a block onto the front of the free list. */
+static void free_list_insert (header_s* header_ptr) {
+
+  header_ptr->prev = NULL;
+  header_ptr->next = free_list;
+  if (free_list != NULL) {
+    free_list->prev = header_ptr;
+  }
+  free_list = header_ptr;
+
+} // free_list_insert ()
+
+/** Unlink a block from the free list. */
+static void free_list_remove (header_s* header_ptr) {
+
+  if (header_ptr->prev == NULL) {
+    free_list = header_ptr->next;
+  } else {
+    header_ptr->prev->next = header_ptr->next;
+  }
+  if (header_ptr->next != NULL) {
+    header_ptr->next->prev = header_ptr->prev;
+  }
+
+} // free_list_remove ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The initialization method.  If this is the first use of the heap, initialize
+ * it.  Must be called with the heap lock held.
+ */
+
+static void init () {
+
+  // Only do anything if there is no heap region (i.e., first time called).
+  if (start_addr == 0) {
+
+    DEBUG("Trying to initialize");
+
+    // Allocate virtual address space in which the heap will reside. Make it
+    // un-shared and not backed by any file (_anonymous_ space).  A failure to
+    // map this space is fatal.
+    void* heap = mmap(NULL,
+		      HEAP_SIZE,
+		      PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS,
+		      -1,
+		      0);
+    if (heap == MAP_FAILED) {
+      ERROR("Could not mmap() heap region");
+    }
+
+    // Hold onto the boundaries of the heap as a whole.  Start the first block
+    // just far enough in that its usable space is aligned.
+    start_addr = (intptr_t)heap;
+    end_addr   = start_addr + HEAP_SIZE;
+    free_addr  = start_addr + ALIGNMENT - HEADER_SIZE;
+    high_addr  = free_addr;
+
+    // Choose how quickly free pages decay.
+    const char* decay = getenv(DECAY_ENV);
+    if (decay != NULL) {
+      decay_ms = strtol(decay, NULL, 10);
+    }
+
+    // DEBUG: Emit a message to indicate that this allocator is being called.
+    DEBUG("bf-alloc initialized");
+
+  }
+
+} // init ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+// The sweep thread, restarted in the child of a fork, is defined below.
+static void sweep_start ();
+// ==============================================================================
+
+
+
+// ==============================================================================
+// FORK HANDLERS
+
+/** Quiesce the heap before a `fork()`: take the heap lock. */
+static void fork_prepare () {
+  pthread_mutex_lock(&heap_lock);
+} // fork_prepare ()
+
+/** Release the heap lock in the parent, once the `fork()` is done. */
+static void fork_parent () {
+  pthread_mutex_unlock(&heap_lock);
+} // fork_parent ()
+
+/**
+ * Release the heap lock in the child, which shares the trace file, too.  The
+ * sweep thread, like every other, did not survive the fork, so start another.
+ */
+static void fork_child () {
+
+  trace_fork_child();
+  pthread_mutex_unlock(&heap_lock);
+  sweep_start();
+
+} // fork_child ()
+
+/** Register the fork handlers, and start the sweep thread, as the library is loaded. */
+static void __attribute__ ((constructor)) fork_setup () {
+
+  pthread_atfork(fork_prepare, fork_parent, fork_child);
+  sweep_start();
+
+} // fork_setup ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The current time, from a clock that is cheap to read.
+ *
+ * \return The time, in milliseconds.
+ */
+static long now_ms () {
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+  return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+} // now_ms ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Return the whole pages within a span to the kernel.  `MADV_FREE` lets the
+ * kernel reclaim them lazily, only under memory pressure, and keeps them cheap
+ * to re-use; where it is unsupported, fall back to `MADV_DONTNEED`.
+ *
+ * \param start The beginning of the span.
+ * \param end   The end of the span.
+ */
+static void purge_span (intptr_t start, intptr_t end) {
+
+  intptr_t page_mask  = PAGE_SIZE - 1;
+  intptr_t page_start = (start + page_mask) & ~page_mask;
+  intptr_t page_end   = end & ~page_mask;
+  if (page_end <= page_start) {
+    return;
+  }
+
+  DEBUG("Purging: ", page_start, page_end);
+  if (madvise((void*)page_start, page_end - page_start, MADV_FREE) != 0) {
+    madvise((void*)page_start, page_end - page_start, MADV_DONTNEED);
+  }
+
+} // purge_span ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Sweep the free list.  A free block seen for the first time is marked as
+ * aged; one already aged has its interior pages purged, leaving its header,
+ * links, and boundary tag in place.  The pages past the free pointer, which
+ * are never re-used until the heap expands again, are purged at once.  Must be
+ * called with the heap lock held.
+ *
+ * \param now The current time, in milliseconds.
+ */
+static void sweep (long now) {
+
+  last_sweep_ms     = now;
+  freed_since_sweep = 0;
+
+  for (header_s* current = free_list; current != NULL; current = current->next) {
+    if (current->size & PURGED_BIT) {
+      continue;
+    }
+    if (current->size & AGED_BIT) {
+      purge_span((intptr_t)current + sizeof(header_s),
+		 (intptr_t)current + block_size(current) - FOOTER_SIZE);
+      current->size |= PURGED_BIT;
+    } else {
+      current->size |= AGED_BIT;
+    }
+  }
+
+  if (high_addr > free_addr) {
+    purge_span(free_addr, high_addr);
+    high_addr = free_addr;
+  }
+
+} // sweep ()
+
+/**
+ * Sweep the free list, if a decay interval has passed (or enough bytes have
+ * been freed) since the last sweep.  Must be called with the heap lock held.
+ */
+static void maybe_sweep () {
+
+  if (decay_ms <= 0) {
+    return;
+  }
+  long now = now_ms();
+  if (now - last_sweep_ms < decay_ms && freed_since_sweep < SWEEP_THRESHOLD) {
+    return;
+  }
+  sweep(now);
+
+} // maybe_sweep ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Sweep the free list whenever a decay interval passes without a sweep, for as
+ * long as the process runs.
+ *
+ * \param unused Unused.
+ * \return       Never returns.
+ */
+static void* sweep_loop (void* unused) {
+
+  while (true) {
+    pthread_mutex_lock(&heap_lock);
+    long now  = now_ms();
+    long wait = last_sweep_ms + decay_ms - now;
+    if (wait <= 0) {
+      sweep(now);
+      wait = decay_ms;
+    }
+    pthread_mutex_unlock(&heap_lock);
+    struct timespec interval = { .tv_sec = wait / 1000, .tv_nsec = (wait % 1000) * 1000000 };
+    nanosleep(&interval, NULL);
+  }
+  return unused;
+
+} // sweep_loop ()
+
+/**
+ * Start the background sweep thread, unless purging is disabled, with every
+ * signal blocked, so that none is delivered to it in place of the program's own
+ * threads.  Must be called without the heap lock held, since creating a thread
+ * may allocate.
+ */
+static void sweep_start () {
+
+  pthread_mutex_lock(&heap_lock);
+  init();
+  bool enabled = (decay_ms > 0);
+  pthread_mutex_unlock(&heap_lock);
+  if (!enabled) {
+    return;
+  }
+
+  pthread_attr_t attr;
+  pthread_t      thread;
+  sigset_t       all;
+  sigset_t       old;
+  sigfillset(&all);
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  if (pthread_create(&thread, &attr, sweep_loop, NULL) == 0) {
+    pthread_setname_np(thread, "bf-sweep");
+  } else {
+    DEBUG("Could not start the sweep thread");
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  pthread_attr_destroy(&attr);
+
+} // sweep_start ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Find the smallest free block of at least `size` bytes, stopping early on an
+ * exact fit.
+ *
+ * \param size The whole block size needed.
+ * \return     The best-fitting free block, if any; `NULL` otherwise.
+ */
+static header_s* find_best_fit (size_t size) {
+
+  header_s* best = NULL;
+  for (header_s* current = free_list; current != NULL; current = current->next) {
+    size_t current_size = block_size(current);
+    if (current_size >= size && (best == NULL || current_size < block_size(best))) {
+      best = current;
+      if (current_size == size) {
+	break;
+      }
+    }
+  }
+
+  return best;
+
+} // find_best_fit ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Mark a block as allocated with `size` bytes, first splitting off the rest of
+ * it as a new free block if that remainder is large enough to be one.  The
+ * remainder, untouched, keeps the record of decay of the free space it came
+ * from, so that carving from the front of a large span does not restart its
+ * aging.
+ *
+ * \param header_ptr The block, which must not be on the free list.
+ * \param size       The whole block size needed.
+ * \param decay      The record of decay of the free space in the block.
+ */
+static void split_and_allocate (header_s* header_ptr, size_t size, size_t decay) {
+
+  size_t available = block_size(header_ptr);
+  if (available - size >= MIN_BLOCK_SIZE) {
+    header_s* remainder = (header_s*)((intptr_t)header_ptr + size);
+    set_block(remainder, available - size, false);
+    remainder->size |= decay;
+    free_list_insert(remainder);
+    available = size;
+  }
+  set_block(header_ptr, available, true);
+
+} // split_and_allocate ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Compute the whole block size needed to hold `size` usable bytes.
+ *
+ * \param size The number of usable bytes requested.
+ * \return     The block size, or `0` if the request could never fit.
+ */
+static size_t needed_size (size_t size) {
+
+  if (size > HEAP_SIZE) {
+    return 0;
+  }
+  size_t needed = ALIGN_UP(size + HEADER_SIZE + FOOTER_SIZE);
+  return (needed < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : needed);
+
+} // needed_size ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Take a block of `needed` bytes.  Use the best-fitting free block, if there
+ * is one; otherwise, expand into the heap region via _pointer bumping_.  Must
+ * be called with the heap lock held.
+ *
+ * \param needed The whole block size needed.
+ * \return       The allocated block, if successful; `NULL` if unsuccessful.
+ */
+static header_s* take_block (size_t needed) {
+
+  header_s* header_ptr = find_best_fit(needed);
+  if (header_ptr != NULL) {
+
+    // Re-use a free block, returning any excess to the free list.
+    free_list_remove(header_ptr);
+    split_and_allocate(header_ptr, needed, header_ptr->size & DECAY_BITS);
+
+  } else {
+
+    // Nothing fits, so expand the heap.
+    if (needed > (size_t)(end_addr - free_addr)) {
+      return NULL;
+    }
+    header_ptr = (header_s*)free_addr;
+    free_addr += needed;
+    if (free_addr > high_addr) {
+      high_addr = free_addr;
+    }
+    set_block(header_ptr, needed, true);
+
+  }
+
+  return header_ptr;
+
+} // take_block ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate and return `size` bytes of heap space.
+ *
+ * \param size The number of bytes to allocate.
+ * \return A pointer to the allocated block, if successful; `NULL` if
+ *         unsuccessful.
+ */
+static void* allocate (size_t size) {
+
+  if (size == 0) {
+    return NULL;
+  }
+  size_t needed = needed_size(size);
+  if (needed == 0) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&heap_lock);
+  init();
+  header_s* header_ptr = take_block(needed);
+  pthread_mutex_unlock(&heap_lock);
+  return (header_ptr != NULL ? block_of(header_ptr) : NULL);
+
+} // allocate ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate and return `size` bytes of heap space.
+ *
+ * \param size The number of bytes to allocate.
+ * \return A pointer to the allocated block, if successful; `NULL` if
+ *         unsuccessful.
+ */
+void* malloc (size_t size) {
+
+  void* block_ptr = allocate(size);
+  TRACE(TRACE_MALLOC, block_ptr, size, 0);
+  return block_ptr;
+
+} // malloc()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Give back a block.  Coalesce it with any free neighbors, and then add it to
+ * the free list---or, if it ends at the edge of the used heap, return it to the
+ * unused region instead.  Must be called with the heap lock held.
+ *
+ * \param ptr A pointer to the block to be deallocated.
+ */
+static void release_block (void* ptr) {
+
+  header_s* header_ptr = header_of(ptr);
+  if (!is_allocated(header_ptr)) {
+    ERROR("free(): block is not allocated: ", (intptr_t)ptr);
+  }
+  size_t size  = block_size(header_ptr);
+  size_t decay = 0;
+  freed_since_sweep += size;
+
+  // Merge with the preceding block, if it is free.
+  if ((intptr_t)header_ptr > start_addr + ALIGNMENT - HEADER_SIZE) {
+    header_s* prev = prev_block(header_ptr);
+    if (!is_allocated(prev)) {
+      free_list_remove(prev);
+      decay      = merged_decay(prev->size & DECAY_BITS, block_size(prev), decay, size);
+      size      += block_size(prev);
+      header_ptr = prev;
+    }
+  }
+
+  // Merge with the following block, if it is free.  If there is no following
+  // block, give the space back to the unused region.
+  header_s* next = (header_s*)((intptr_t)header_ptr + size);
+  if ((intptr_t)next == free_addr) {
+    free_addr = (intptr_t)header_ptr;
+  } else {
+    if (!is_allocated(next)) {
+      free_list_remove(next);
+      decay = merged_decay(decay, size, next->size & DECAY_BITS, block_size(next));
+      size += block_size(next);
+    }
+    set_block(header_ptr, size, false);
+    header_ptr->size |= decay;
+    free_list_insert(header_ptr);
+  }
+
+} // release_block ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Deallocate a given block on the heap, if any, and then sweep the free list,
+ * if it is due.
+ *
+ * \param ptr A pointer to the block to be deallocated.
+ */
+static void deallocate (void* ptr) {
+
+  if (ptr == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&heap_lock);
+  release_block(ptr);
+  maybe_sweep();
+  pthread_mutex_unlock(&heap_lock);
+
+} // deallocate ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Deallocate a given block on the heap.
+ *
+ * \param ptr A pointer to the block to be deallocated.
+ */
+void free (void* ptr) {
+
+  DEBUG("free(): ", (intptr_t)ptr);
+
+  TRACE(TRACE_FREE, ptr, 0, 0);
+  deallocate(ptr);
+
+} // free()
+// ==============================================================================
+
+
+// ==============================================================================
+/**
+ * Deallocate a block whose size is known, as C23's `free_sized()`.  The size
+ * cannot spare reading the header, which the coalescing of neighbors needs
+ * anyway.
+ *
+ * \param ptr  A pointer to the block to be deallocated.
+ * \param size The size requested when the block was allocated.
+ */
+void free_sized (void* ptr, size_t size) {
+
+  TRACE(TRACE_FREE, ptr, size, 0);
+  deallocate(ptr);
+
+} // free_sized ()
+
+/**
+ * Deallocate an aligned block whose size is known, as C23's
+ * `free_aligned_sized()`.
+ *
+ * \param ptr       A pointer to the block to be deallocated.
+ * \param alignment The alignment requested when the block was allocated.
+ * \param size      The size requested when the block was allocated.
+ */
+void free_aligned_sized (void* ptr, size_t alignment, size_t size) {
+
+  TRACE(TRACE_FREE, ptr, size, alignment);
+  deallocate(ptr);
+
+} // free_aligned_sized ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `count` blocks of `size` bytes each, taking the heap lock just once
+ * for them all.
+ *
+ * \param size  The number of bytes in each block.
+ * \param count The number of blocks to allocate.
+ * \param out   Filled with the blocks, in order.
+ * \return      The number of blocks allocated.
+ */
+size_t pb_malloc_batch (size_t size, size_t count, void** out) {
+
+  size_t needed = needed_size(size);
+  if (size == 0 || needed == 0) {
+    return 0;
+  }
+
+  size_t done = 0;
+  pthread_mutex_lock(&heap_lock);
+  init();
+  for (; done < count; ++done) {
+    header_s* header_ptr = take_block(needed);
+    if (header_ptr == NULL) {
+      break;
+    }
+    out[done] = block_of(header_ptr);
+  }
+  pthread_mutex_unlock(&heap_lock);
+
+  if (__builtin_expect(trace_state != TRACE_OFF, false)) {
+    for (size_t i = 0; i < done; ++i) {
+      TRACE(TRACE_MALLOC, out[i], size, 0);
+    }
+  }
+  return done;
+
+} // pb_malloc_batch ()
+
+/**
+ * Deallocate `count` blocks, from last to first, taking the heap lock (and
+ * considering a sweep) just once for them all.  Freed in that order, a batch
+ * just past the rest of the used heap is coalesced into the unused region.
+ *
+ * \param ptrs  The blocks.
+ * \param count The number of blocks.
+ */
+void pb_free_batch (void** ptrs, size_t count) {
+
+  for (size_t i = count; i > 0; --i) {
+    TRACE(TRACE_FREE, ptrs[i - 1], 0, 0);
+  }
+
+  pthread_mutex_lock(&heap_lock);
+  for (size_t i = count; i > 0; --i) {
+    if (ptrs[i - 1] != NULL) {
+      release_block(ptrs[i - 1]);
+    }
+  }
+  maybe_sweep();
+  pthread_mutex_unlock(&heap_lock);
+
+} // pb_free_batch ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a block of `nmemb * size` bytes on the heap, zeroing its contents.
+ *
+ * \param nmemb The number of elements in the new block.
+ * \param size  The size, in bytes, of each of the `nmemb` elements.
+ * \return      A pointer to the newly allocated and zeroed block, if successful;
+ *              `NULL` if unsuccessful.
+ */
+void* calloc (size_t nmemb, size_t size) {
+
+  // Refuse requests whose total size overflows.
+  size_t block_size;
+  if (__builtin_mul_overflow(nmemb, size, &block_size)) {
+    return NULL;
+  }
+
+  // Allocate a block of the requested size.
+  void* block_ptr = allocate(block_size);
+
+  // If the allocation succeeded, clear the entire block.
+  if (block_ptr != NULL) {
+    memset(block_ptr, 0, block_size);
+  }
+
+  TRACE(TRACE_CALLOC, block_ptr, block_size, nmemb);
+  return block_ptr;
+
+} // calloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `size` bytes, aligned to `alignment`.  Take a block with room to
+ * spare for the alignment, and then give back the space before the aligned
+ * address (which is kept large enough to be a block of its own) and after the
+ * end of the request, each of which coalesces like any freed block.
+ *
+ * \param alignment The alignment, a power of two.
+ * \param size      The number of bytes to allocate.
+ * \return          A pointer to the allocated block, if successful; `NULL` if
+ *                  unsuccessful.
+ */
+static void* aligned_allocate (size_t alignment, size_t size) {
+
+  if (alignment <= ALIGNMENT) {
+    return allocate(size);
+  }
+  size_t needed = needed_size(size);
+  if (size == 0 || needed == 0 || alignment > HEAP_SIZE) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&heap_lock);
+  init();
+  header_s* header_ptr = take_block(needed + alignment + MIN_BLOCK_SIZE);
+  if (header_ptr == NULL) {
+    pthread_mutex_unlock(&heap_lock);
+    return NULL;
+  }
+
+  // Find the first aligned address that leaves room for a leading free block.
+  intptr_t usable  = (intptr_t)block_of(header_ptr);
+  intptr_t aligned = (usable + alignment - 1) & ~((intptr_t)alignment - 1);
+  if (aligned > usable && aligned - usable < (intptr_t)MIN_BLOCK_SIZE) {
+    aligned += alignment;
+  }
+  if (aligned > usable) {
+    size_t    lead           = aligned - usable;
+    header_s* aligned_header = header_of((void*)aligned);
+    set_block(aligned_header, block_size(header_ptr) - lead, true);
+    set_block(header_ptr, lead, true);
+    release_block(block_of(header_ptr));
+    header_ptr = aligned_header;
+  }
+
+  // Give back the space past the request, as `split_and_allocate()` would.
+  size_t available = block_size(header_ptr);
+  if (available - needed >= MIN_BLOCK_SIZE) {
+    set_block(header_ptr, needed, true);
+    header_s* rest = next_block(header_ptr);
+    set_block(rest, available - needed, true);
+    release_block(block_of(rest));
+  }
+  pthread_mutex_unlock(&heap_lock);
+  return (void*)aligned;
+
+} // aligned_allocate ()
+// ==============================================================================
+
+
+// ==============================================================================
+/**
+ * Allocate `size` bytes, aligned to `alignment`.
+ *
+ * \param memptr    Set to the allocated block, if successful.
+ * \param alignment The alignment, a power of two and a multiple of
+ *                  `sizeof(void*)`.
+ * \param size      The number of bytes to allocate.
+ * \return          `0` if successful; `EINVAL` if the alignment is invalid;
+ *                  `ENOMEM` if the block could not be allocated.
+ */
+int posix_memalign (void** memptr, size_t alignment, size_t size) {
+
+  if (!IS_POWER_OF_TWO(alignment) || alignment % sizeof(void*) != 0) {
+    return EINVAL;
+  }
+  void* block_ptr = aligned_allocate(alignment, size);
+  TRACE(TRACE_MEMALIGN, block_ptr, size, alignment);
+  if (block_ptr == NULL && size != 0) {
+    return ENOMEM;
+  }
+  *memptr = block_ptr;
+  return 0;
+
+} // posix_memalign ()
+
+/**
+ * Allocate `size` bytes, aligned to `alignment`.
+ *
+ * \param alignment The alignment, a power of two.
+ * \param size      The number of bytes to allocate.
+ * \return          A pointer to the allocated block, if successful; `NULL` if
+ *                  unsuccessful.
+ */
+void* aligned_alloc (size_t alignment, size_t size) {
+
+  if (!IS_POWER_OF_TWO(alignment)) {
+    errno = EINVAL;
+    return NULL;
+  }
+  void* block_ptr = aligned_allocate(alignment, size);
+  TRACE(TRACE_MEMALIGN, block_ptr, size, alignment);
+  return block_ptr;
+
+} // aligned_alloc ()
+
+/**
+ * Allocate `size` bytes, aligned to `alignment`, which (as in glibc) is rounded
+ * up to a power of two if it is not one.
+ *
+ * \param alignment The alignment.
+ * \param size      The number of bytes to allocate.
+ * \return          A pointer to the allocated block, if successful; `NULL` if
+ *                  unsuccessful.
+ */
+void* memalign (size_t alignment, size_t size) {
+
+  size_t power = ALIGNMENT;
+  while (power < alignment && power <= HEAP_SIZE) {
+    power <<= 1;
+  }
+  void* block_ptr = aligned_allocate(power, size);
+  TRACE(TRACE_MEMALIGN, block_ptr, size, power);
+  return block_ptr;
+
+} // memalign ()
+
+/**
+ * Allocate `size` bytes, aligned to a page.
+ *
+ * \param size The number of bytes to allocate.
+ * \return     A pointer to the allocated block, if successful; `NULL` if
+ *             unsuccessful.
+ */
+void* valloc (size_t size) {
+  return memalign(PAGE_SIZE, size);
+} // valloc ()
+
+/**
+ * Allocate `size` bytes, rounded up to a whole number of pages, and aligned to
+ * a page.
+ *
+ * \param size The number of bytes to allocate.
+ * \return     A pointer to the allocated block, if successful; `NULL` if
+ *             unsuccessful.
+ */
+void* pvalloc (size_t size) {
+
+  size_t page_size = PAGE_SIZE;
+  if (size > HEAP_SIZE) {
+    return NULL;
+  }
+  return memalign(page_size, (size + page_size - 1) & ~(page_size - 1));
+
+} // pvalloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Update the given block at `ptr` to take on the given `size`.  Here, if `size`
+ * fits within the given block, then the block is returned unchanged.  If the
+ * `size` is an increase for the block, then the block is first grown in place
+ * into a free neighbor or the unused heap region, if possible.  Otherwise, a new
+ * and larger block is allocated, and the data from the old block is copied, the
+ * old block freed, and the new block returned.
+ *
+ * \param ptr  The block to be assigned a new size.
+ * \param size The new size that the block should assume.
+ * \return     A pointer to the resultant block, which may be `ptr` itself, or
+ *             may be a newly allocated block.
+ */
+static void* reallocate (void* ptr, size_t size) {
+
+  if (ptr == NULL) {
+    return allocate(size);
+  }
+
+  if (size == 0) {
+    deallocate(ptr);
+    return NULL;
+  }
+
+  header_s* header_ptr = header_of(ptr);
+  size_t    old_size   = block_size(header_ptr) - HEADER_SIZE - FOOTER_SIZE;
+  if (size <= old_size) {
+    return ptr;
+  }
+  size_t needed = needed_size(size);
+  if (needed == 0) {
+    return NULL;
+  }
+
+  // Try to grow the block in place.
+  pthread_mutex_lock(&heap_lock);
+  size_t    current = block_size(header_ptr);
+  header_s* next    = next_block(header_ptr);
+  if ((intptr_t)next == free_addr) {
+
+    // The block is the last one, so extend it into the unused region.
+    if (needed - current <= (size_t)(end_addr - free_addr)) {
+      free_addr += needed - current;
+      if (free_addr > high_addr) {
+	high_addr = free_addr;
+      }
+      set_block(header_ptr, needed, true);
+      pthread_mutex_unlock(&heap_lock);
+      return ptr;
+    }
+
+  } else if (!is_allocated(next) && current + block_size(next) >= needed) {
+
+    // The following block is free and large enough, so absorb it.
+    size_t decay = next->size & DECAY_BITS;
+    free_list_remove(next);
+    set_block(header_ptr, current + block_size(next), true);
+    split_and_allocate(header_ptr, needed, decay);
+    pthread_mutex_unlock(&heap_lock);
+    return ptr;
+
+  }
+  pthread_mutex_unlock(&heap_lock);
+
+  // Otherwise, move the block.
+  void* new_ptr = allocate(size);
+  if (new_ptr != NULL) {
+    memcpy(new_ptr, ptr, old_size);
+    deallocate(ptr);
+  }
+  return new_ptr;
+
+} // reallocate ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Update the given block at `ptr` to take on the given `size`.
+ *
+ * \param ptr  The block to be assigned a new size.
+ * \param size The new size that the block should assume.
+ * \return     A pointer to the resultant block, which may be `ptr` itself, or
+ *             may be a newly allocated block.
+ */
+void* realloc (void* ptr, size_t size) {
+
+  void* new_ptr = reallocate(ptr, size);
+  TRACE(TRACE_REALLOC, new_ptr, size, (uintptr_t)ptr);
+  return new_ptr;
+
+} // realloc()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The number of usable bytes in a block, which may be more than were requested.
+ * Exported, so that glibc's version never reads a header of this heap.
+ *
+ * \param ptr The block.
+ * \return    The block's size; `0` if `ptr` is `NULL`.
+ */
+size_t malloc_usable_size (void* ptr) {
+  return (ptr == NULL ? 0 : block_size(header_of(ptr)) - HEADER_SIZE - FOOTER_SIZE);
+} // malloc_usable_size ()
+// ==============================================================================
+
+
+
+#if defined (ALLOC_MAIN)
+// ==============================================================================
+/**
+ * The entry point if this code is compiled as a standalone program for testing
+ * purposes.
+ */
+int main () {
+
+  // Allocate a few blocks, then free them.
+  void* x = malloc(16);
+  void* y = malloc(64);
+  void* z = malloc(32);
+
+  free(z);
+  free(y);
+  free(x);
+
+  return 0;
+
+} // main()
+// ==============================================================================
+#endif
@@ -0,0 +1,55 @@
+// ==============================================================================
+/**
+ * free-sized.h
+ *
+ * Sized deallocation, as in C23.  A caller that knows the size (and alignment)
+ * with which it allocated a block may say so when freeing it.  Every allocator
+ * here exports these, so that they may be called whatever libc provides; each
+ * treats the size as a promise from the caller, but never relies on it where a
+ * wrong size could corrupt its heap.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// Avoid multiple inclusion.
+
+#if !defined (_FREE_SIZED_H)
+#define _FREE_SIZED_H
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <stddef.h>
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Deallocate a block allocated by `malloc()`, `calloc()`, or `realloc()`.
+ *
+ * \param ptr  The block, or `NULL`.
+ * \param size The size requested when the block was allocated.
+ */
+void free_sized (void* ptr, size_t size);
+
+/**
+ * Deallocate a block allocated by `aligned_alloc()`.
+ *
+ * \param ptr       The block, or `NULL`.
+ * \param alignment The alignment requested when the block was allocated.
+ * \param size      The size requested when the block was allocated.
+ */
+void free_aligned_sized (void* ptr, size_t alignment, size_t size);
+// ==============================================================================
+
+
+
+// ==============================================================================
+#endif // _FREE_SIZED_H
+// ==============================================================================
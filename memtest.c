@@ -1,6 +1,38 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "pb-arena.h"
+#include "pb-heap.h"
+
+#define THREADS           4
+#define BLOCKS_PER_THREAD 10000
+
+/*Each thread allocates blocks, stamps them with its id, then checks that no other thread overwrote them.*/
+void* stamp_blocks (void* arg){
+  unsigned char id = (unsigned char)(intptr_t)arg;
+  unsigned char* blocks[BLOCKS_PER_THREAD];
+  intptr_t failures = 0;
+  for (int i = 0; i < BLOCKS_PER_THREAD; i++) {
+    blocks[i] = malloc(24);
+    memset(blocks[i], id, 24);
+  }
+  for (int i = 0; i < BLOCKS_PER_THREAD; i++) {
+    for (int j = 0; j < 24; j++) {
+      if (blocks[i][j] != id) {
+        failures++;
+      }
+    }
+  }
+  return (void*)failures;
+}
 
 int main (int argc, char **argv){
 
@@ -14,47 +46,53 @@ int main (int argc, char **argv){
   
 
   /*TEST: not copying when new_size == old_size (confirming for ≤)*/
-  char* x_new = realloc(x, 24);
+  uintptr_t x_old = (uintptr_t)x; // compared by address, since realloc() may free x
   printf("x_old = %p\n", x);
-  printf("x_new = %p\n", x);
-  if (x == x_new) {
+  char* x_new = realloc(x, 24);
+  printf("x_new = %p\n", x_new);
+  if (x_old == (uintptr_t)x_new) {
   	printf("TEST_1 (without copying when new_size == old_size) PASSES\n");
   } else {
   	printf("TEST_1 (without copying when new_size == old_size) FAILS\n");
   }
 
   /*TEST: not copying when new_size < old_size (confirming for ≤)*/
-  x_new = realloc(x, 22);
-  printf("x_old = %p\n", x);
-  printf("x_new = %p\n", x);
-  if(x == x_new){
+  x_old = (uintptr_t)x_new;
+  printf("x_old = %p\n", x_new);
+  x_new = realloc(x_new, 22);
+  printf("x_new = %p\n", x_new);
+  if(x_old == (uintptr_t)x_new){
   	printf("TEST_2 (without copying when new_size < old_size) PASSES\n");
   } else {
   	printf("TEST_2 (without copying when new_size < old_size) FAILS\n");
   }
 
   /*TEST: copying when new_size > old_size*/
+  uintptr_t y_old = (uintptr_t)y;
   char* y_new = realloc(y, 23);
-  if (y == y_new) {
+  if (y_old == (uintptr_t)y_new) {
   	printf("TEST_3 (with copying when new_size > old_size) PASSES\n");
   } else {
   	printf("TEST_3 (with copying when new_size > old_size) FAILS\n");
   }
 
   /*TEST: reallocation copies contents correctly*/
-  size_t* arr = malloc(13); // allocate memory for array of chars of length 9
+  size_t* arr = malloc(13 * sizeof(size_t)); // allocate memory for array of 13 words
   for(size_t ct = 0; ct < 13; ct++) { //fill in array
   	*(arr + ct) = ct;
   }
-  size_t* arr_ = realloc(arr, 17); //realloc() to do memcpy()
-  printf("TEST 4....\n");
-  for(size_t i = 0; i < 13; i++){
-    if((*arr_ + i) != (*arr + i)){
-		  printf("TEST_4 (reallocation copies contents correctly) FAILS\n");
+  size_t* arr_ = realloc(arr, 17 * sizeof(size_t)); //realloc() to do memcpy()
+  int copied = 1;
+  for(size_t ct = 0; ct < 13; ct++){ //compare against the values written, not the old block
+    if(arr_[ct] != ct){
+      copied = 0;
     }
   }
-  printf("TEST 4....\n");
-  // printf("TEST_4 (reallocation copies contents correctly) PASSES\n");
+  if (copied) {
+    printf("TEST_4 (reallocation copies contents correctly) PASSES\n");
+  } else {
+    printf("TEST_4 (reallocation copies contents correctly) FAILS\n");
+  }
 
   /*TEST: alignment of malloced pointers*/
   char* ptr1 = malloc(111);
@@ -77,4 +115,228 @@ int main (int argc, char **argv){
   }else{
     printf("TEST_6 (realloc alignment) FAILS\n");
   }
+
+  /*TEST: concurrent mallocs never hand out overlapping blocks*/
+  pthread_t threads[THREADS];
+  intptr_t overlaps = 0;
+  for (intptr_t t = 0; t < THREADS; t++) {
+    pthread_create(&threads[t], NULL, stamp_blocks, (void*)(t + 1));
+  }
+  for (int t = 0; t < THREADS; t++) {
+    void* failures;
+    pthread_join(threads[t], &failures);
+    overlaps += (intptr_t)failures;
+  }
+  if (overlaps == 0) {
+    printf("TEST_7 (concurrent malloc does not overlap blocks) PASSES\n");
+  } else {
+    printf("TEST_7 (concurrent malloc does not overlap blocks) FAILS\n");
+  }
+
+  /*TEST: growing the latest block does not move it (libpb only)*/
+  if (dlsym(RTLD_DEFAULT, "pb_isolate") == NULL) {
+    printf("TEST_8 (realloc grows the latest block in place) SKIPPED (not libpb)\n");
+  } else {
+    char* top = malloc(1000);
+    uintptr_t top_old = (uintptr_t)top;
+    char* top_new = realloc(top, 5000);
+    if (top_old == (uintptr_t)top_new) {
+      printf("TEST_8 (realloc grows the latest block in place) PASSES\n");
+    } else {
+      printf("TEST_8 (realloc grows the latest block in place) FAILS\n");
+    }
+  }
+
+  /*TEST: aligned allocations are aligned, usable, and reject bad alignments*/
+  size_t sizes[] = { 1, 100, 4096, 1024 * 1024 + 1, 8 * 1024 * 1024 };
+  int misaligned = 0;
+  for (size_t alignment = 8; alignment <= 2 * 1024 * 1024; alignment *= 2) {
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+      void* block = NULL;
+      if (posix_memalign(&block, alignment, sizes[s]) != 0 || (intptr_t)block % alignment != 0) {
+        misaligned++;
+      } else {
+        memset(block, 0xab, sizes[s]);
+        free(block);
+      }
+      size_t rounded = (sizes[s] + alignment - 1) / alignment * alignment;
+      block = aligned_alloc(alignment, rounded);
+      if (block == NULL || (intptr_t)block % alignment != 0) {
+        misaligned++;
+      } else {
+        memset(block, 0xcd, rounded);
+        free(block);
+      }
+    }
+  }
+  void* bad = NULL;
+  if (posix_memalign(&bad, 24, 100) != EINVAL || posix_memalign(&bad, 4, 100) != EINVAL) {
+    misaligned++;
+  }
+  if (misaligned == 0) {
+    printf("TEST_9 (posix_memalign and aligned_alloc alignment) PASSES\n");
+  } else {
+    printf("TEST_9 (posix_memalign and aligned_alloc alignment) FAILS\n");
+  }
+
+  /*TEST: a file-backed arena keeps its blocks, grown or not, once reopened (libpb only)*/
+  __typeof__(pb_arena_open)*     arena_open     = dlsym(RTLD_DEFAULT, "pb_arena_open");
+  __typeof__(pb_arena_alloc)*    arena_alloc    = dlsym(RTLD_DEFAULT, "pb_arena_alloc");
+  __typeof__(pb_arena_root)*     arena_root     = dlsym(RTLD_DEFAULT, "pb_arena_root");
+  __typeof__(pb_arena_set_root)* arena_set_root = dlsym(RTLD_DEFAULT, "pb_arena_set_root");
+  __typeof__(pb_arena_destroy)*  arena_destroy  = dlsym(RTLD_DEFAULT, "pb_arena_destroy");
+  if (arena_open == NULL) {
+    printf("TEST_10 (file-backed arena survives reopening) SKIPPED (not libpb)\n");
+  } else {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/memtest-arena.%d", (int)getpid());
+    unlink(path);
+    int lost = 0;
+    pb_arena_t* arena = arena_open(path, 1024 * 1024, NULL);
+    char* arena_end = (char*)arena + 2 * 1024 * 1024;
+    size_t* index = (arena == NULL ? NULL : arena_alloc(arena, 16 * sizeof(size_t)));
+    if (index == NULL) {
+      lost++;
+    } else {
+      for (size_t i = 0; i < 16; i++) {
+        index[i] = i;
+      }
+      index = realloc(index, 64 * sizeof(size_t)); // the last block, grown in place
+      arena_alloc(arena, 8);
+      index = realloc(index, 128 * sizeof(size_t)); // no longer the last, so moved
+      if (index == NULL || (char*)index < (char*)arena || (char*)index >= arena_end) {
+        lost++;
+      } else {
+        for (size_t i = 16; i < 128; i++) {
+          index[i] = i;
+        }
+        arena_set_root(arena, index);
+      }
+      arena_destroy(arena);
+    }
+    arena = (lost == 0 ? arena_open(path, 0, NULL) : NULL);
+    index = (arena == NULL ? NULL : arena_root(arena));
+    if (index == NULL) {
+      lost++;
+    } else {
+      for (size_t i = 0; i < 128; i++) {
+        if (index[i] != i) {
+          lost++;
+        }
+      }
+      arena_destroy(arena);
+    }
+    unlink(path);
+    if (lost == 0) {
+      printf("TEST_10 (file-backed arena survives reopening) PASSES\n");
+    } else {
+      printf("TEST_10 (file-backed arena survives reopening) FAILS\n");
+    }
+  }
+
+  /*TEST: a separate heap's blocks are its own, and are gone once it is destroyed (libpb only)*/
+  __typeof__(pb_heap_create)*  heap_create  = dlsym(RTLD_DEFAULT, "pb_heap_create");
+  __typeof__(pb_heap_malloc)*  heap_malloc  = dlsym(RTLD_DEFAULT, "pb_heap_malloc");
+  __typeof__(pb_heap_destroy)* heap_destroy = dlsym(RTLD_DEFAULT, "pb_heap_destroy");
+  if (heap_create == NULL) {
+    printf("TEST_11 (pb_heap_destroy drops the heap's blocks) SKIPPED (not libpb)\n");
+  } else {
+    int stray = 0;
+    pb_heap_t* heap = heap_create(1024 * 1024, 0);
+    unsigned char* heap_blocks[1000];
+    for (int i = 0; i < 1000; i++) {
+      heap_blocks[i] = (heap == NULL ? NULL : heap_malloc(heap, 1 + i % 100));
+      if (heap_blocks[i] == NULL || (intptr_t)heap_blocks[i] % 16 != 0 ||
+          heap_blocks[i] < (unsigned char*)heap || heap_blocks[i] >= (unsigned char*)heap + 4 * 1024 * 1024) {
+        stray++;
+        break;
+      }
+      memset(heap_blocks[i], i, 1 + i % 100);
+    }
+    for (int i = 0; stray == 0 && i < 1000; i++) {
+      for (int j = 0; j < 1 + i % 100; j++) {
+        if (heap_blocks[i][j] != (unsigned char)i) {
+          stray++;
+        }
+      }
+    }
+    if (heap != NULL) {
+      heap_destroy(heap);
+      // Once unmapped, the heap's pages cannot even be synced.
+      void* page = (void*)((intptr_t)heap_blocks[0] & ~(intptr_t)4095);
+      if (msync(page, 4096, MS_ASYNC) == 0 || errno != ENOMEM) {
+        stray++;
+      }
+    }
+    if (stray == 0) {
+      printf("TEST_11 (pb_heap_destroy drops the heap's blocks) PASSES\n");
+    } else {
+      printf("TEST_11 (pb_heap_destroy drops the heap's blocks) FAILS\n");
+    }
+  }
+
+  /*TEST: one thread alternating between two heaps fills both, not just their first chunks (libpb only)*/
+  if (heap_create == NULL) {
+    printf("TEST_12 (interleaved heaps keep their chunks) SKIPPED (not libpb)\n");
+  } else {
+    int wasted = 0;
+    pb_heap_t* heaps[2] = { heap_create(1024 * 1024, 0), heap_create(1024 * 1024, 0) };
+    if (heaps[0] == NULL || heaps[1] == NULL) {
+      wasted++;
+    }
+    // 32 bytes apiece, so 20000 blocks fill most of each 1 MB heap.
+    for (int i = 0; wasted == 0 && i < 2 * 20000; i++) {
+      pb_heap_t*     heap  = heaps[i % 2];
+      unsigned char* block = heap_malloc(heap, 16);
+      if (block == NULL || block < (unsigned char*)heap || block >= (unsigned char*)heap + 4 * 1024 * 1024) {
+        wasted++;
+      }
+    }
+    for (int h = 0; h < 2; h++) {
+      if (heaps[h] != NULL) {
+        heap_destroy(heaps[h]);
+      }
+    }
+    if (wasted == 0) {
+      printf("TEST_12 (interleaved heaps keep their chunks) PASSES\n");
+    } else {
+      printf("TEST_12 (interleaved heaps keep their chunks) FAILS\n");
+    }
+  }
+
+  /*TEST: realloc() grows a heap's block within that heap, or not at all (libpb only)*/
+  if (heap_create == NULL) {
+    printf("TEST_13 (realloc keeps heap blocks in their heap) SKIPPED (not libpb)\n");
+  } else {
+    int escaped = 0;
+    pb_heap_t*     heap  = heap_create(1024 * 1024, 0);
+    unsigned char* block = (heap == NULL ? NULL : heap_malloc(heap, 16));
+    if (block != NULL) {
+      memset(block, 0x5a, 16);
+    }
+    // Every other step allocates after the block, so that growing it must copy.
+    for (size_t size = 32; block != NULL && size <= 64 * 1024; size *= 2) {
+      block = realloc(block, size);
+      if (block == NULL || block < (unsigned char*)heap || block >= (unsigned char*)heap + 4 * 1024 * 1024 ||
+          block[0] != 0x5a || block[15] != 0x5a) {
+        escaped++;
+        break;
+      }
+      if (size % 64 == 0 && heap_malloc(heap, 16) == NULL) {
+        escaped++;
+      }
+    }
+    // A block too large for the heap is refused, not moved out of it.
+    if (block != NULL && realloc(block, 8 * 1024 * 1024) != NULL) {
+      escaped++;
+    }
+    if (heap != NULL) {
+      heap_destroy(heap);
+    }
+    if (escaped == 0) {
+      printf("TEST_13 (realloc keeps heap blocks in their heap) PASSES\n");
+    } else {
+      printf("TEST_13 (realloc keeps heap blocks in their heap) FAILS\n");
+    }
+  }
 }
@@ -4,6 +4,33 @@
  *
  * A _pointer-bumping_ heap allocator.  This allocator *does not re-use* freed
  * blocks.  It uses _pointer bumping_ to expand the heap with each allocation.
+ *
+ * The heap survives `fork()`: handlers registered as the library loads take
+ * every lock before the fork, so that the child inherits none held, and then
+ * reset the child's view of its parent's threads.  Since these handlers are
+ * registered before any of the program's own, theirs run first, and may
+ * still allocate.
+ *
+ * No entry point that allocates or frees is async-signal-safe, since a signal
+ * handler could interrupt its own thread in the middle of bumping or rolling
+ * back a TLAB or small page.  These, which neither take a lock nor write any
+ * shared state, are safe to call from a signal handler: `malloc_usable_size()`,
+ * `pb_isolate()`, `pb_node_stats()`, and `pb_arena_mark()`.
+ *
+ * Setting `PB_PREFAULT` faults in the start of the heap as it is initialized,
+ * and `PB_PREFAULT_AHEAD` keeps a background thread faulting in pages ahead of
+ * the free pointers, so that latency-critical programs take no page faults in
+ * the middle of a request.
+ *
+ * Built with `PB_HARDENED` defined (as `libpb-hardened.so`), the heap also
+ * checks itself for corruption.  Every header carries a canary, sealed with a
+ * per-process secret, that `free()` and `realloc()` check; and, if
+ * `PB_GUARD_RATE` is set, about one allocation in that many is placed against a
+ * guard page, as GWP-ASan does, so that an overflow off its end, or a use of it
+ * after it is freed, faults and is reported.  Both are cheap enough to leave on
+ * under load: the canary costs a multiply per headered block, and sampling a
+ * countdown per allocation.  (Small blocks carry no header, and so are checked
+ * only when sampled.)
  **/
 // ==============================================================================
 
@@ -12,16 +39,39 @@
 // ==============================================================================
 // INCLUDES
 
+#define _GNU_SOURCE
 #include <assert.h>
+#include <execinfo.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <signal.h>
+#include <sys/auxv.h>
+#include <sys/file.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 
+#include "free-sized.h"
+#include "pb-arena.h"
+#include "pb-batch.h"
+#include "pb-heap.h"
+#include "pb-isolate.h"
+#include "pb-prof.h"
+#include "pb-stats.h"
 #include "safeio.h"
+#include "trace.h"
 // ==============================================================================
 
 
@@ -29,8 +79,8 @@
 // ==============================================================================
 // MACRO CONSTANTS AND FUNCTIONS
 
-/** The system's page size. */
-#define PAGE_SIZE sysconf(_SC_PAGESIZE)
+/** The system's page size, looked up once when the heap is initialized. */
+#define PAGE_SIZE page_size
 
 /**
  * Macros to easily calculate the number of bytes for larger scales (e.g., kilo,
@@ -40,21 +90,380 @@
 #define MB(size)  (KB(size) * 1024)
 #define GB(size)  (MB(size) * 1024)
 
-/** The virtual address space reserved for the heap. */
-#define HEAP_SIZE GB(2)
+/**
+ * The virtual address space reserved for each segment of the heap.  The heap
+ * starts as one segment, and grows by another whenever the current one fills.
+ */
+#define SEGMENT_SIZE GB(2)
+
+/**
+ * Reserved address space is _committed_ (made readable and writable) in steps
+ * of this many bytes, as each region's free pointer crosses its watermark.
+ */
+#define COMMIT_SIZE MB(4)
+
+/**
+ * The heap may be backed by huge pages, selected by setting the `PB_HUGEPAGES`
+ * environment variable to `transparent` (hinting the kernel with `madvise()`)
+ * or `explicit` (mapping from the `hugetlbfs` pool with `MAP_HUGETLB`).  If
+ * explicit huge pages run out, the heap falls back to transparent ones.
+ */
+#define HUGE_PAGES_ENV         "PB_HUGEPAGES"
+#define HUGE_PAGES_NONE        0
+#define HUGE_PAGES_TRANSPARENT 1
+#define HUGE_PAGES_EXPLICIT    2
+
+/** The size of a huge page, to which every reservation is aligned. */
+#define HUGE_PAGE_SIZE MB(2)
+
+/** The largest request that is even considered. */
+#define MAX_REQUEST_SIZE ((size_t)PTRDIFF_MAX)
+
+/** The alignment of every block returned by `malloc()`. */
+#define ALIGNMENT 16
+
+/** Round `value` up to the next multiple of `ALIGNMENT`. */
+#define ALIGN_UP(value) (((value) + (ALIGNMENT - 1)) & ~((size_t)ALIGNMENT - 1))
+
+/** Whether `value` is a power of two. */
+#define IS_POWER_OF_TWO(value) ((value) != 0 && ((value) & ((value) - 1)) == 0)
+
+/**
+ * The size of each thread-local allocation buffer (TLAB): the chunk of the heap
+ * that a thread claims from the shared region and then bumps through privately.
+ */
+#define TLAB_SIZE MB(2)
+
+/**
+ * Blocks (with header) larger than this are claimed directly from the shared
+ * region, rather than wasting most of a TLAB on a single block.
+ */
+#define TLAB_MAX_BLOCK (TLAB_SIZE / 8)
+
+/**
+ * Each thread allocates from a separate heap through a chunk of this many
+ * bytes, claimed from the heap's region.  Blocks (with header) larger than
+ * `HEAP_CHUNK_MAX_BLOCK` are claimed directly.
+ */
+#define HEAP_CHUNK_SIZE      KB(64)
+#define HEAP_CHUNK_MAX_BLOCK (HEAP_CHUNK_SIZE / 8)
+
+/**
+ * Each thread keeps chunks of up to this many separate heaps at once, in a
+ * table indexed by heap number, so that a thread serving several subsystems
+ * in turn keeps a chunk of each.  Heaps whose numbers collide in the table take
+ * turns with one slot, abandoning the rest of each other's chunks.
+ */
+#define HEAP_CHUNK_SLOTS 8
+
+/**
+ * Small blocks are kept _headerless_: each is rounded up to a multiple of the
+ * alignment (its _size class_) and placed in a _small page_ that holds blocks
+ * of only that class.  The page's own header records the class, so a block's
+ * size can be found from its address alone.  Small pages are carved from their
+ * own region of `SMALL_REGION_SIZE` bytes, aligned to the page size.
+ */
+#define SMALL_MAX_SIZE    256
+#define SMALL_CLASSES     (SMALL_MAX_SIZE / ALIGNMENT)
+#define SMALL_PAGE_SIZE   KB(64)
+#define SMALL_REGION_SIZE GB(1)
+
+/**
+ * Blocks of at least this many bytes are given their own mapping, which is
+ * unmapped when they are freed, rather than consuming the heap forever.  Set by
+ * the `PB_MMAP_THRESHOLD` environment variable, but never below
+ * `TLAB_MAX_BLOCK`.
+ */
+#define MMAP_THRESHOLD_ENV     "PB_MMAP_THRESHOLD"
+#define DEFAULT_MMAP_THRESHOLD MB(1)
+
+/**
+ * Latency-critical programs may have the heap's pages faulted in before they
+ * are used, rather than one at a time in the middle of a request.  `PB_PREFAULT`
+ * names the number of bytes of each partition's first segment, and of its small
+ * page region, to fault in when the heap is initialized.  `PB_PREFAULT_AHEAD`
+ * starts a background thread that keeps that many bytes faulted in ahead of each
+ * region's free pointer, checking every `PREFAULT_INTERVAL` nanoseconds.
+ */
+#define PREFAULT_ENV       "PB_PREFAULT"
+#define PREFAULT_AHEAD_ENV "PB_PREFAULT_AHEAD"
+#define PREFAULT_INTERVAL  1000000
+
+/** Older headers lack the advice that faults pages in without writing them. */
+#if !defined (MADV_POPULATE_WRITE)
+#define MADV_POPULATE_WRITE 23
+#endif
+
+/** Setting this environment variable emits the heap's statistics at exit. */
+#define STATS_ENV "PB_STATS"
+
+/**
+ * The file that backs the arena returned by `pb_heap_file()`, the space to
+ * reserve for it if new, and the address at which to map it if new.
+ */
+#define HEAP_FILE_ENV          "PB_HEAP_FILE"
+#define HEAP_FILE_SIZE_ENV     "PB_HEAP_FILE_SIZE"
+#define HEAP_FILE_BASE_ENV     "PB_HEAP_FILE_BASE"
+#define DEFAULT_HEAP_FILE_SIZE GB(1)
+
+/** The most file-backed arenas that may be open at once. */
+#define OPEN_ARENAS_MAX 64
+
+/** The magic number in the descriptor of a file-backed arena. */
+#define ARENA_FILE_MAGIC UINT64_C(0x31666172616e6270)
+
+/** Older headers lack the flag that keeps a fixed mapping from clobbering. */
+#if !defined (MAP_FIXED_NOREPLACE)
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+/**
+ * The sampling profiler is turned on by `PB_PROFILE`, which names the prefix of
+ * the profile written at exit.  On average, one allocation is sampled per
+ * `PB_PROFILE_RATE` bytes.  Samples are kept in a table of `PROF_MAX_SAMPLES`
+ * entries, mapped (but committed only as it fills) when the heap is first
+ * initialized; samples beyond that are dropped.
+ */
+#define PROF_ENV          "PB_PROFILE"
+#define PROF_RATE_ENV     "PB_PROFILE_RATE"
+#define PROF_DEFAULT_RATE KB(512)
+#define PROF_MAX_SAMPLES  (1 << 16)
+#define PROF_MAX_DEPTH    32
+#define PROF_PATH_LENGTH  256
+#define PROF_BUFFER_SIZE  KB(4)
+
+/**
+ * In a hardened build, `PB_GUARD_RATE` turns on guard-page sampling: on
+ * average, one allocation in that many, of at most a page, is placed at the end
+ * of one of `GUARD_SLOTS` pages, each flanked by inaccessible guard pages.
+ */
+#define GUARD_RATE_ENV "PB_GUARD_RATE"
+#define GUARD_SLOTS    256
+
+/** The states of a guard slot. */
+#define GUARD_FREE      0
+#define GUARD_USED      1
+#define GUARD_RELEASING 2
+
+/** The size of a cache line, which small page headers are padded to fill. */
+#define CACHE_LINE_SIZE 64
+
+/**
+ * Blocks of at most this many bytes are isolated on cache lines of their own,
+ * by default.  (See `pb-isolate.h`.)
+ */
+#define ISOLATE_ENV "PB_ISOLATE"
+
+/**
+ * Thread-local storage for the allocator's per-thread state.  The
+ * _initial-exec_ model keeps accesses to a single instruction, and ensures that
+ * touching it never calls back into `malloc()`.
+ */
+#define THREAD_LOCAL __thread __attribute__ ((tls_model ("initial-exec")))
+
+/** Round `value` up to the next multiple of `size`, a power of two. */
+#define ROUND_UP(value, size) (((value) + ((size) - 1)) & ~((intptr_t)(size) - 1))
+
+/**
+ * On a machine with more than one NUMA node, the heap is partitioned by node:
+ * each node has its own chain of segments and its own part of the small page
+ * region, whose pages the kernel prefers to place on that node, and each
+ * thread claims TLABs and small pages from the partition of the node on which
+ * it is running.  Setting `PB_NUMA` to `0` turns the partitioning off; setting
+ * it to anything else turns it on, even on a machine with a single node.
+ */
+#define NUMA_ENV       "PB_NUMA"
+#define NUMA_NODE_PATH "/sys/devices/system/node/online"
+#define NUMA_MAX_NODES 64
+
+/** The states through which the heap passes during initialization. */
+#define HEAP_UNINITIALIZED 0
+#define HEAP_INITIALIZING  1
+#define HEAP_READY         2
 // ==============================================================================
 
 
 // ==============================================================================
 // TYPES AND STRUCTURES
 
+/**
+ * A region of address space that is reserved up front, but committed lazily.
+ * Each segment of the heap is a region whose descriptor sits at its own start;
+ * the small page region's descriptor is a global.
+ */
+typedef struct region {
+
+  /** The beginning of the region. */
+  intptr_t start_addr;
+
+  /** The address of the next available byte in the region. */
+  intptr_t free_addr;
+
+  /** The end of the committed part of the region: its commit watermark. */
+  intptr_t commit_addr;
+
+  /** The end of the region. */
+  intptr_t end_addr;
+
+  /**
+   * The end of the space that may have been written and then given back.
+   * Anything claimed above this is still as the kernel provided it: zeroed.
+   */
+  intptr_t dirty_addr;
+
+  /** The segment that was current before this one, if any. */
+  struct region* prev;
+
+  /** The NUMA node to which the region is bound, or `-1` if it is unbound. */
+  int node;
+
+} region_s;
+
 /** A header for each block's metadata. */
 typedef struct header {
 
   /** The size of the useful portion of the block, in bytes. */
   size_t size;
+
+  /** Flags recording how the block was allocated. */
+  uint32_t flags;
+
+  /** In a hardened build, a check on the rest of the header (and its place). */
+  uint32_t canary;
   
 } header_s;
+
+/** A header flag marking a block that has a mapping of its own. */
+#define HEADER_MAPPED  0x1
+
+/**
+ * A header flag marking a block allocated from an arena or a separate heap,
+ * which is left to be released with the rest of it.
+ */
+#define HEADER_ARENA   0x2
+
+/** A header flag marking a block sampled onto a guard slot. */
+#define HEADER_GUARDED 0x4
+
+/**
+ * A header flag marking a block from a file-backed arena, whose canary is
+ * sealed without the per-process secret, so that it outlasts the process.
+ */
+#define HEADER_PERSISTENT 0x8
+
+/**
+ * A header flag marking a block from a separate heap, which also carries
+ * `HEADER_ARENA`, and which `realloc()` keeps within that heap.
+ */
+#define HEADER_HEAP 0x10
+
+/**
+ * A header for each small page's metadata.  Padded to a full cache line, so
+ * that writes to the first block never contend with reads of the metadata.
+ */
+typedef struct page {
+
+  /** The size of every block in the page, in bytes. */
+  size_t block_size;
+
+  char padding[CACHE_LINE_SIZE - sizeof(size_t)];
+
+} page_s;
+
+/** An arena, whose descriptor sits at the start of its own region. */
+struct pb_arena {
+
+  /** The region from which the arena's blocks are allocated. */
+  region_s region;
+
+  /** The free pointer of the empty arena, to which a reset releases it. */
+  intptr_t base_addr;
+
+  /** The furthest that the arena's free pointer has ever reached. */
+  intptr_t high_addr;
+
+  /** How much of the arena to keep resident when it is released. */
+  size_t retain_size;
+
+  /** For a file-backed arena, `ARENA_FILE_MAGIC`; otherwise, `0`. */
+  uint64_t magic;
+
+  /** The arena's root block, if any. */
+  void* root;
+
+  /**
+   * The open file that backs the arena, or `-1`.  Being rewritten whenever the
+   * file is opened, this is meaningful only to the process that opened it.
+   */
+  int fd;
+
+};
+
+/** A thread's chunk of a separate heap. */
+typedef struct heap_chunk {
+
+  /** The number of the heap (see `pb_heap`), or `0` if the slot is empty. */
+  uint64_t id;
+
+  /** The next free byte of the chunk, and its end. */
+  intptr_t free_addr;
+  intptr_t end_addr;
+
+} heap_chunk_s;
+
+/** A separate heap, whose descriptor sits at the start of its own region. */
+struct pb_heap {
+
+  /** The region from which the heap's chunks and blocks are claimed. */
+  region_s region;
+
+  /** The heap's free pointer when it was empty. */
+  intptr_t base_addr;
+
+  /**
+   * A number unique to this heap, so that a thread's chunk of a heap since
+   * destroyed is never mistaken for one of a new heap at the same address.
+   */
+  uint64_t id;
+
+  /** The neighboring heaps on the list of live heaps. */
+  struct pb_heap* next;
+  struct pb_heap* prev;
+
+};
+
+/**
+ * A thread's own statistics, which only it updates.  Each is linked onto a
+ * global list when the thread first calls into the heap, and folded into the
+ * totals of exited threads when it exits.
+ */
+typedef struct thread_stats {
+
+  /** The thread's counts of calls and bytes. */
+  pb_stats_t counts;
+
+  /** The neighboring threads' statistics on the list. */
+  struct thread_stats* next;
+  struct thread_stats* prev;
+
+  /** Whether these statistics are on the list. */
+  bool linked;
+
+} thread_stats_s;
+
+/** A sampled allocation, with the call stack that made it. */
+typedef struct prof_sample {
+
+  /** The number of bytes requested. */
+  size_t size;
+
+  /** The depth of the call stack, or `0` while the sample is being filled. */
+  int depth;
+
+  /** The return addresses of the call stack, innermost first. */
+  void* stack[PROF_MAX_DEPTH];
+
+} prof_sample_s;
 // ==============================================================================
 
 
@@ -62,178 +471,3456 @@ typedef struct header {
 // ==============================================================================
 // GLOBALS
 
-/** The address of the next available byte in the heap region. */
-static intptr_t free_addr  = 0;
+/**
+ * The current segment of each NUMA node's partition of the heap, from which
+ * threads claim TLABs and large blocks.  Its free pointer is always kept such
+ * that `free_addr + sizeof(header_s)` is `ALIGNMENT`-aligned.  Without
+ * partitioning, only the first is used.
+ */
+static region_s* current_segments[NUMA_MAX_NODES];
+
+/**
+ * The regions from which each node's small pages are claimed, which together
+ * make up one contiguous span.
+ */
+static region_s small_regions[NUMA_MAX_NODES];
 
-/** The beginning of the heap. */
-static intptr_t start_addr = 0;
+/** The number of partitions of the heap: one, unless partitioned by node. */
+static int numa_nodes = 1;
 
-/** The end of the heap. */
-static intptr_t end_addr   = 0;
-// ==============================================================================
+/** Whether the partitions are bound to their nodes. */
+static bool numa_bound = false;
+
+/**
+ * The bytes claimed from each node's partition, and the number of TLABs and
+ * small pages claimed from it.
+ */
+static size_t node_heap_bytes[NUMA_MAX_NODES];
+static size_t node_refills[NUMA_MAX_NODES];
 
+/** Held while replacing the current segment. */
+static int grow_lock = 0;
 
+/** Held while committing space in any region. */
+static int commit_lock = 0;
+
+/** The kind of huge pages that back the heap, if any. */
+static int huge_pages = HUGE_PAGES_NONE;
+
+/** The size at and above which blocks are given their own mapping. */
+static size_t mmap_threshold = DEFAULT_MMAP_THRESHOLD;
+
+/** The system's page size (see `PAGE_SIZE`). */
+static size_t page_size = 0;
 
-// ==============================================================================
 /**
- * The initialization method.  If this is the first use of the heap, initialize it.
+ * The bytes of each region to fault in at initialization, and to keep faulted
+ * in ahead of each free pointer.
  */
+static size_t prefault_bytes = 0;
+static size_t prefault_ahead = 0;
 
-void init () {
+/** Whether the kernel lacks `MADV_POPULATE_WRITE`, so pages must be touched. */
+static bool prefault_touch = false;
 
-  // Only do anything if there is no heap region (i.e., first time called).
-  if (start_addr == 0) {
+/** The largest block that each new thread isolates on its own cache lines. */
+static size_t isolate_default = 0;
 
-    DEBUG("Trying to initialize");
-    
-    // Allocate virtual address space in which the heap will reside. Make it
-    // un-shared and not backed by any file (_anonymous_ space).  A failure to
-    // map this space is fatal.
-    void* heap = mmap(NULL,
-		      HEAP_SIZE,
-		      PROT_READ | PROT_WRITE,
-		      MAP_PRIVATE | MAP_ANONYMOUS,
-		      -1,
-		      0);
-    if (heap == MAP_FAILED) {
-      ERROR("Could not mmap() heap region");
-    }
+/**
+ * The largest block that this thread isolates on its own cache lines.  Set from
+ * the default when the thread first calls into the heap.
+ */
+static THREAD_LOCAL size_t thread_isolate = 0;
+
+/**
+ * The partition from which this thread claims space: that of the node on which
+ * it last ran when it claimed a TLAB or small page.
+ */
+static THREAD_LOCAL int thread_node = 0;
 
-    // Hold onto the boundaries of the heap as a whole.
-    start_addr = (intptr_t)heap;
-    end_addr   = start_addr + HEAP_SIZE;
-    free_addr  = start_addr;
+/** The beginning of this thread's TLAB. */
+static THREAD_LOCAL intptr_t tlab_start = 0;
 
-    // DEBUG: Emit a message to indicate that this allocator is being called.
-    DEBUG("bp-alloc initialized");
+/** The next available byte in this thread's TLAB. */
+static THREAD_LOCAL intptr_t tlab_free = 0;
 
-  }
+/** The end of this thread's TLAB. */
+static THREAD_LOCAL intptr_t tlab_end  = 0;
 
-} // init ()
+/** The end of the space in this thread's TLAB that may not be zeroed. */
+static THREAD_LOCAL intptr_t tlab_dirty = 0;
+
+/** The next available block in this thread's current page of each small class. */
+static THREAD_LOCAL intptr_t small_free[SMALL_CLASSES];
+
+/** The end of this thread's current page of each small class. */
+static THREAD_LOCAL intptr_t small_end[SMALL_CLASSES];
+
+/** The end of the space in each current small page that may not be zeroed. */
+static THREAD_LOCAL intptr_t small_dirty[SMALL_CLASSES];
+
+/** The initialization state of the heap, set once by the initializing thread. */
+static int heap_state = HEAP_UNINITIALIZED;
+
+/** This thread's statistics. */
+static THREAD_LOCAL thread_stats_s thread_stats;
+
+/** The statistics of every living thread that has called into the heap. */
+static thread_stats_s* stats_list = NULL;
+
+/** The summed statistics of every exited thread. */
+static pb_stats_t retired_stats;
+
+/** Held while changing the list of statistics, or summing it. */
+static int stats_lock = 0;
+
+/** The key whose destructor retires an exiting thread's statistics. */
+static pthread_key_t stats_key;
+
+/** Whether that key has been created yet. */
+static bool stats_key_ready = false;
+
+/** The bytes claimed from the heap's regions, now and at their highest. */
+static size_t heap_bytes      = 0;
+static size_t heap_high_water = 0;
+
+/** The bytes held by blocks that have their own mappings. */
+static size_t mapped_bytes = 0;
+
+/** The number of separate heaps ever created. */
+static uint64_t heap_count = 0;
+
+/** This thread's chunks of separate heaps, each in the slot of its heap. */
+static THREAD_LOCAL heap_chunk_s heap_chunks[HEAP_CHUNK_SLOTS];
+
+/**
+ * The separate heaps not yet destroyed, by which `realloc()` finds the heap of
+ * a block, so as to grow it there.
+ */
+static pb_heap_t* heap_list = NULL;
+
+/** Held while creating or destroying a separate heap, or finding one. */
+static int heap_list_lock = 0;
+
+/** The arena backed by the file named in the environment, once opened. */
+static pb_arena_t* heap_file       = NULL;
+static bool        heap_file_tried = false;
+
+/** Held while opening that arena. */
+static int heap_file_lock = 0;
+
+/**
+ * The file-backed arenas open in this process, by which `realloc()` finds the
+ * arena of a persistent block, so as to grow it there.
+ */
+static pb_arena_t* open_arenas[OPEN_ARENAS_MAX];
+
+/** Held while opening or destroying a file-backed arena, or finding one. */
+static int open_arenas_lock = 0;
+
+/** The mean interval between samples, in bytes, or `0` if profiling is off. */
+static size_t prof_rate = 0;
+
+/** The table of samples, and the number of its entries claimed so far. */
+static prof_sample_s* prof_samples = NULL;
+static size_t         prof_used    = 0;
+
+/** The prefix of the profile written at exit. */
+static char prof_path[PROF_PATH_LENGTH];
+
+/**
+ * The bytes that this thread may still allocate before its next sample.  It
+ * starts at zero, so that each thread's first allocation takes the slow path
+ * that draws its first interval (or, if profiling is off, disables sampling).
+ */
+static THREAD_LOCAL int64_t prof_countdown = 0;
+
+/** The state of this thread's random number generator, once seeded. */
+static THREAD_LOCAL uint64_t prof_random = 0;
+
+/** Set while this thread takes a sample, so that it never samples itself. */
+static THREAD_LOCAL bool prof_busy = false;
+
+#if defined (PB_HARDENED)
+/** The secret with which every header's canary is sealed. */
+static uint32_t canary_secret = 0;
+
+/** The mean interval between guarded samples, in allocations, or `0` if off. */
+static size_t guard_rate = 0;
+
+/**
+ * The guard slots: alternating guard pages and slots, starting and ending with
+ * a guard page.  Each slot's state, and the next slot to try.
+ */
+static intptr_t guard_pool   = 0;
+static int      guard_states[GUARD_SLOTS];
+static size_t   guard_cursor = 0;
+
+/** The handler of segmentation faults that preceded the guard's own. */
+static struct sigaction guard_prev_action;
+
+/** The allocations that this thread may make before its next guarded one. */
+static THREAD_LOCAL int64_t guard_countdown = 0;
+
+/** The state of this thread's random number generator, once seeded. */
+static THREAD_LOCAL uint64_t guard_random = 0;
+#endif // PB_HARDENED
 // ==============================================================================
 
 
+
 // ==============================================================================
 /**
- * Allocate and return `size` bytes of heap space.  Expand into the heap region
- * via _pointer bumping_.
+ * Acquire a spin lock.  These guard only the rare slow paths that replace or
+ * commit regions.
  *
- * \param size The number of bytes to allocate.
+ * \param lock The lock.
+ */
+static void spin_lock (int* lock) {
 
- * \return A pointer to the allocated block, if successful; `NULL` if
- *         unsuccessful.
+  while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+    sched_yield();
+  }
+
+} // spin_lock ()
+
+/**
+ * Release a spin lock.
+ *
+ * \param lock The lock.
  */
-void* malloc (size_t size) {
+static void spin_unlock (int* lock) {
+  __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+} // spin_unlock ()
+// ==============================================================================
 
-  init(); //initialize the heap the FIRST time malloc gets called	
 
-  if (size == 0) { //if requested block size is zeero, return null
-    return NULL;
+
+// ==============================================================================
+/**
+ * Reserve address space, without committing any of it.  The space is mapped
+ * inaccessible, so that it counts against neither the process's memory nor the
+ * system's commit limit until it is committed.  It is aligned to a huge page,
+ * over-reserving and then trimming the excess.
+ *
+ * \param size The number of bytes to reserve, a multiple of the huge page size.
+ * \return     The start of the reserved space, if successful; `0` if
+ *             unsuccessful.
+ */
+static intptr_t reserve (size_t size) {
+
+  size_t padded = size + HUGE_PAGE_SIZE;
+  void*  space  = mmap(NULL,
+		       padded,
+		       PROT_NONE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+		       -1,
+		       0);
+  if (space == MAP_FAILED) {
+    return 0;
   }
 
-  size_t    total_size = size + sizeof(header_s); //header size has to be accounted for in the total size of the allocated memory
-  
-  size_t    padding = 16 - ( (free_addr + sizeof(header_s)) % 16 ); //padding to be added before header and after free_addr for double world alignment of block_ptr
-  if(padding == 16){//already aligned if free_addr + header_size == 16...
-    padding = 0; //...so no padding
-  }
-  header_s* header_ptr = (header_s*) (free_addr + padding); //pointer to header of the block replaced with address to next available byte in the heap
-  void*     block_ptr  = (void*)(free_addr + padding + sizeof(header_s)); //block_ptr becomes address to header, shifted right by the header size
-  intptr_t new_free_addr = free_addr + padding + total_size; //next available free address may be shifted to the right by (block_size + header_size)
-  if (new_free_addr > end_addr) { //if next possibly free address goes out of the stack's bounds, return Null
-    return NULL;
-  } else { //else, the address of the next available block (free-addr) updates
-    free_addr = new_free_addr;
+  intptr_t space_addr = (intptr_t)space;
+  intptr_t start      = ROUND_UP(space_addr, HUGE_PAGE_SIZE);
+  if (start > space_addr) {
+    munmap(space, start - space_addr);
   }
-  header_ptr->size = size; //(*header_ptr).size = size
-                          //update the header's (pointed to by header_ptr) size property to the requested block when calling malloc
-  return block_ptr; //returns pointer to block (not header)
-} // malloc()
+  munmap((void*)(start + size), space_addr + padded - (start + size));
+  return start;
+
+} // reserve ()
 // ==============================================================================
 
 
 
 // ==============================================================================
 /**
- * Deallocate a given block on the heap.  Add the given block (if any) to the
- * free list.
+ * Ask the kernel to place the pages of a span on a NUMA node, when it can.
+ * Being only a preference, this need not succeed.
  *
- * \param ptr A pointer to the block to be deallocated.
+ * \param start  The beginning of the span, aligned to a page.
+ * \param length The length of the span.
+ * \param node   The node, or `-1` to leave the span unbound.
  */
-void free (void* ptr) {
+static void numa_bind (intptr_t start, size_t length, int node) {
 
-  DEBUG("free(): ", (intptr_t)ptr);
+  if (node < 0) {
+    return;
+  }
+  unsigned long mask = 1UL << node;
+  if (syscall(SYS_mbind, start, length, MPOL_PREFERRED, &mask, NUMA_MAX_NODES + 1, 0) != 0) {
+    DEBUG("mbind() failed: ", start, length, (intptr_t)node);
+  }
 
-} // free()
+} // numa_bind ()
 // ==============================================================================
 
 
 
 // ==============================================================================
 /**
- * Allocate a block of `nmemb * size` bytes on the heap, zeroing its contents.
+ * Commit a span of reserved space, backing it with huge pages if so
+ * configured, and binding it to its region's node.  Must be called with the
+ * commit lock held.
  *
- * \param nmemb The number of elements in the new block.
- * \param size  The size, in bytes, of each of the `nmemb` elements.
- * \return      A pointer to the newly allocated and zeroed block, if successful;
- *              `NULL` if unsuccessful.
+ * \param start The beginning of the span, aligned to a huge page.
+ * \param end   The end of the span, aligned to a huge page.
+ * \param node  The node to bind the span to, or `-1`.
+ * \return      `true` if successful; `false` if the span could not be
+ *              committed.
  */
-void* calloc (size_t nmemb, size_t size) {
+static bool commit_span (intptr_t start, intptr_t end, int node) {
 
-  // Allocate a block of the requested size.
-  size_t block_size = nmemb * size;
-  void*  block_ptr  = malloc(block_size);
+  DEBUG("Committing: ", start, end);
+  size_t length = end - start;
 
-  // If the allocation succeeded, clear the entire block.
-  if (block_ptr != NULL) {
-    memset(block_ptr, 0, block_size);
+  // Replace the reservation with explicit huge pages.  This maps (and reserves
+  // from the pool) only the pages being committed, so it fails cleanly if the
+  // pool is empty; in that case, stop trying.
+  if (huge_pages == HUGE_PAGES_EXPLICIT) {
+    void* span = mmap((void*)start,
+		      length,
+		      PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB,
+		      -1,
+		      0);
+    if (span != MAP_FAILED) {
+      numa_bind(start, length, node);
+      return true;
+    }
+    DEBUG("Explicit huge pages unavailable; using transparent ones");
+    huge_pages = HUGE_PAGES_TRANSPARENT;
+
+    // The failed attempt may already have unmapped the reservation, so map
+    // ordinary pages in its place, rather than just changing its protection.
+    span = mmap((void*)start,
+		length,
+		PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE,
+		-1,
+		0);
+    if (span == MAP_FAILED) {
+      return false;
+    }
+
+  } else if (mprotect((void*)start, length, PROT_READ | PROT_WRITE) != 0) {
+    return false;
+  }
+  if (huge_pages == HUGE_PAGES_TRANSPARENT) {
+    madvise((void*)start, length, MADV_HUGEPAGE);
   }
+  numa_bind(start, length, node);
+  return true;
 
-  return block_ptr;
-  
-} // calloc ()
+} // commit_span ()
 // ==============================================================================
 
 
 
 // ==============================================================================
 /**
- * Update the given block at `ptr` to take on the given `size`.  Here, if `size`
- * fits within the given block, then the block is returned unchanged.  If the
- * `size` is an increase for the block, then a new and larger block is
- * allocated, and the data from the old block is copied, the old block freed,
- * and the new block returned.
+ * Ensure that a region is committed up to (at least) the given address,
+ * advancing its watermark by whole commit steps.  The watermark only ever moves
+ * forward, and only after the span beneath it has been committed, so it may be
+ * checked without the lock.
  *
- * \param ptr  The block to be assigned a new size.
- * \param size The new size that the block should assume.
- * \return     A pointer to the resultant block, which may be `ptr` itself, or
- *             may be a newly allocated block.
+ * \param region The region.
+ * \param addr   The address up to which space is needed.
+ * \return       `true` if successful; `false` if the space could not be
+ *               committed.
  */
-void* realloc (void* ptr, size_t size) {
+static bool commit (region_s* region, intptr_t addr) {
 
-  if (ptr == NULL) { //call malloc normally to allocate new block if the pointer is Null
-    return malloc(size);
+  if (addr <= __atomic_load_n(&region->commit_addr, __ATOMIC_ACQUIRE)) {
+    return true;
   }
-  if (size == 0) { //to resize to 0, free the block completely. I.e. call free on the given pointer
-    free(ptr);
-    return NULL;
+
+  // Another thread may have committed this space while we waited for the lock.
+  // Committing twice is not merely wasteful: remapping huge pages over space
+  // already in use would discard its contents.
+  spin_lock(&commit_lock);
+  bool     success   = true;
+  intptr_t committed = region->commit_addr;
+  if (addr > committed) {
+    intptr_t target = ROUND_UP(addr, COMMIT_SIZE);
+    if (target > region->end_addr) {
+      target = region->end_addr;
+    }
+    success = commit_span(committed, target, region->node);
+    if (success) {
+      __atomic_store_n(&region->commit_addr, target, __ATOMIC_RELEASE);
+    }
   }
+  spin_unlock(&commit_lock);
+  return success;
 
-  header_s* old_header = (header_s*)((intptr_t)ptr - sizeof(header_s)); // old block's header pointer = point_to_block - header_size
-  size_t    old_size   = old_header->size; // retrieve old_block_size from its header
-                                          // same as: size_t old_size = (*old_header).size
+} // commit ()
+// ==============================================================================
 
-  if (size <= old_size) { //if desired size (for the block) is ≤ old_size, then can use old pointer
-    return ptr;
+
+
+// ==============================================================================
+/**
+ * Create a new segment of the heap, with its descriptor at its start.
+ *
+ * \param size The number of bytes to reserve for the segment.
+ * \param node The node to bind the segment to, or `-1`.
+ * \return     The new segment, if successful; `NULL` if unsuccessful.
+ */
+static region_s* segment_create (size_t size, int node) {
+
+  // Reserve the segment, and commit its first step, to hold the descriptor.
+  intptr_t start = reserve(size);
+  if (start == 0) {
+    return NULL;
+  }
+  size_t first = (size < COMMIT_SIZE ? size : COMMIT_SIZE);
+  spin_lock(&commit_lock);
+  bool success = commit_span(start, start + first, node);
+  spin_unlock(&commit_lock);
+  if (!success) {
+    munmap((void*)start, size);
+    return NULL;
+  }
+
+  // Start the free pointer just far enough past the descriptor that the first
+  // block (after its header) is aligned.
+  region_s* segment    = (region_s*)start;
+  segment->start_addr  = start;
+  segment->free_addr   = (start + ALIGN_UP(sizeof(region_s))
+			  + ALIGNMENT - sizeof(header_s));
+  segment->commit_addr = start + first;
+  segment->end_addr    = start + size;
+  segment->dirty_addr  = start;
+  segment->prev        = NULL;
+  segment->node        = node;
+  DEBUG("New segment: ", start, size, (intptr_t)node);
+  return segment;
+
+} // segment_create ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Count the NUMA nodes that are online, from the list (such as `0-1`) that the
+ * kernel gives.  Reads the list directly, since `stdio` may allocate.
+ *
+ * \return The number of nodes: one more than the highest listed, or `1` if the
+ *         list cannot be read.
+ */
+static int numa_count () {
+
+  char    list[256];
+  int     fd     = open(NUMA_NODE_PATH, O_RDONLY);
+  ssize_t length = (fd < 0 ? -1 : read(fd, list, sizeof(list) - 1));
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (length <= 0) {
+    return 1;
+  }
+  list[length] = '\0';
+
+  // The highest node ends the list.
+  int highest = 0;
+  for (char* next = list; *next != '\0'; ) {
+    char* end;
+    long  node = strtol(next, &end, 10);
+    if (end == next) {
+      next += 1;
+    } else {
+      highest = (int)node;
+      next    = end;
+    }
+  }
+  return (highest + 1 < NUMA_MAX_NODES ? highest + 1 : NUMA_MAX_NODES);
+
+} // numa_count ()
+
+/**
+ * Find the node on which this thread is running, and claim space from that
+ * node's partition from now on.  Called on the slow paths that claim space,
+ * so that a thread that migrates follows soon after.
+ */
+static inline void numa_locate () {
+
+  unsigned int cpu;
+  unsigned int node;
+  if (numa_nodes > 1 && getcpu(&cpu, &node) == 0 && node < (unsigned int)numa_nodes) {
+    thread_node = node;
+  }
+
+} // numa_locate ()
+// ==============================================================================
+
+
+
+#if defined (PB_HARDENED)
+// ==============================================================================
+// Hardening, defined below, is set up along with the heap.
+static void guard_init ();
+// ==============================================================================
+#endif // PB_HARDENED
+
+
+
+// ==============================================================================
+// PREFAULTING
+
+/**
+ * Fault in the pages of a committed span, as a write would, so that the first
+ * real write to each costs no fault.  The contents of any page already in use
+ * are left as they were.  Without `MADV_POPULATE_WRITE` (before Linux 5.14),
+ * each page is instead touched with an atomic addition of zero, which cannot
+ * lose a concurrent write by its owner.
+ *
+ * \param start The beginning of the span, aligned to a huge page.
+ * \param end   The end of the span, aligned to a huge page.
+ */
+static void prefault_span (intptr_t start, intptr_t end) {
+
+  if (start >= end) {
+    return;
+  }
+  if (!prefault_touch && madvise((void*)start, end - start, MADV_POPULATE_WRITE) == 0) {
+    return;
+  }
+  if (!prefault_touch && errno != EINVAL) {
+    return;
+  }
+  prefault_touch = true;
+  for (intptr_t page = start; page < end; page += PAGE_SIZE) {
+    __atomic_fetch_add((char*)page, 0, __ATOMIC_RELAXED);
+  }
+
+} // prefault_span ()
+
+/**
+ * Commit and fault in the space of a region from one address (or its free
+ * pointer, if further) to a given distance past its free pointer.
+ *
+ * \param region   The region.
+ * \param from     The address to start from, since the space beneath it has
+ *                 already been faulted in.
+ * \param distance The distance past the free pointer to fault in.
+ * \return         The end of the space now faulted in.
+ */
+static intptr_t prefault (region_s* region, intptr_t from, size_t distance) {
+
+  intptr_t free_addr = __atomic_load_n(&region->free_addr, __ATOMIC_RELAXED);
+  intptr_t target    = ROUND_UP(free_addr + distance, HUGE_PAGE_SIZE);
+  if (target > region->end_addr) {
+    target = region->end_addr;
+  }
+  if (target <= from || !commit(region, target)) {
+    return from;
+  }
+
+  // The span beneath the free pointer has been written already, or soon will be.
+  intptr_t start = (from > free_addr ? from : free_addr) & ~((intptr_t)HUGE_PAGE_SIZE - 1);
+  prefault_span(start, target);
+  return target;
+
+} // prefault ()
+
+/**
+ * Keep the space ahead of every region's free pointer committed and faulted
+ * in, for as long as the process runs.
+ *
+ * \param unused Unused.
+ * \return       Never returns.
+ */
+static void* prefault_loop (void* unused) {
+
+  region_s* segments[NUMA_MAX_NODES]     = { NULL };
+  intptr_t  segment_done[NUMA_MAX_NODES] = { 0 };
+  intptr_t  small_done[NUMA_MAX_NODES]   = { 0 };
+  struct timespec interval = { .tv_sec = 0, .tv_nsec = PREFAULT_INTERVAL };
+  while (true) {
+    for (int node = 0; node < numa_nodes; ++node) {
+      region_s* segment = __atomic_load_n(&current_segments[node], __ATOMIC_ACQUIRE);
+      if (segment != segments[node]) {
+	segments[node]     = segment;
+	segment_done[node] = 0;
+      }
+      segment_done[node] = prefault(segment, segment_done[node], prefault_ahead);
+      small_done[node]   = prefault(&small_regions[node], small_done[node], prefault_ahead);
+    }
+    nanosleep(&interval, NULL);
+  }
+  return unused;
+
+} // prefault_loop ()
+
+/**
+ * Start the background thread that faults in pages ahead of the free pointers,
+ * if so configured, with every signal blocked, so that none is delivered to it
+ * in place of the program's own threads.
+ */
+static void prefault_start () {
+
+  if (prefault_ahead == 0) {
+    return;
+  }
+  pthread_attr_t attr;
+  pthread_t      thread;
+  sigset_t       all;
+  sigset_t       old;
+  sigfillset(&all);
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  if (pthread_create(&thread, &attr, prefault_loop, NULL) == 0) {
+    pthread_setname_np(thread, "pb-prefault");
+  } else {
+    DEBUG("Could not start the prefault thread");
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  pthread_attr_destroy(&attr);
+
+} // prefault_start ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The initialization method.  If this is the first use of the heap, initialize
+ * it.  Safe to call concurrently: exactly one thread maps the heap, and any
+ * others that race with it wait until the heap is ready.
+ */
+
+void init () {
+
+  // The common case: the heap has already been set up.
+  if (__atomic_load_n(&heap_state, __ATOMIC_ACQUIRE) == HEAP_READY) {
+    return;
+  }
+
+  // Try to claim the initialization.  If another thread won that race, wait
+  // for it to publish the heap.  (No locks here, since pthread primitives are
+  // not guaranteed to be usable this early.)
+  int expected = HEAP_UNINITIALIZED;
+  if (!__atomic_compare_exchange_n(&heap_state,
+				   &expected,
+				   HEAP_INITIALIZING,
+				   false,
+				   __ATOMIC_ACQUIRE,
+				   __ATOMIC_ACQUIRE)) {
+    while (__atomic_load_n(&heap_state, __ATOMIC_ACQUIRE) != HEAP_READY) {
+      sched_yield();
+    }
+    return;
+  }
+
+  DEBUG("Trying to initialize");
+
+  page_size = sysconf(_SC_PAGESIZE);
+
+  // Choose whether to back the heap with huge pages.
+  const char* huge_pages_mode = getenv(HUGE_PAGES_ENV);
+  if (huge_pages_mode != NULL) {
+    if (strcmp(huge_pages_mode, "transparent") == 0) {
+      huge_pages = HUGE_PAGES_TRANSPARENT;
+    } else if (strcmp(huge_pages_mode, "explicit") == 0) {
+      huge_pages = HUGE_PAGES_EXPLICIT;
+    }
+  }
+
+  // Choose the size at which blocks get their own mapping.
+  const char* threshold = getenv(MMAP_THRESHOLD_ENV);
+  if (threshold != NULL) {
+    mmap_threshold = strtoull(threshold, NULL, 10);
+    if (mmap_threshold < TLAB_MAX_BLOCK) {
+      mmap_threshold = TLAB_MAX_BLOCK;
+    }
+  }
+
+  // Turn on the profiler, if requested, with its table of samples.
+  const char* profile = getenv(PROF_ENV);
+  if (profile != NULL && strnlen(profile, PROF_PATH_LENGTH) < PROF_PATH_LENGTH) {
+    void* table = mmap(NULL,
+		       PROF_MAX_SAMPLES * sizeof(prof_sample_s),
+		       PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+		       -1,
+		       0);
+    if (table != MAP_FAILED) {
+      strcpy(prof_path, profile);
+      prof_samples = (prof_sample_s*)table;
+      const char* rate = getenv(PROF_RATE_ENV);
+      prof_rate = (rate != NULL ? strtoull(rate, NULL, 10) : 0);
+      if (prof_rate == 0) {
+	prof_rate = PROF_DEFAULT_RATE;
+      }
+    }
+  }
+
+  // Choose which blocks to isolate on their own cache lines.
+  const char* isolate = getenv(ISOLATE_ENV);
+  if (isolate != NULL) {
+    isolate_default = (strcmp(isolate, "all") == 0 ?
+		       MAX_REQUEST_SIZE :
+		       strtoull(isolate, NULL, 10));
+  }
+
+  // Choose whether to partition the heap by NUMA node.
+  const char* numa  = getenv(NUMA_ENV);
+  int         nodes = numa_count();
+  numa_bound = (numa != NULL ? strcmp(numa, "0") != 0 : nodes > 1);
+  numa_nodes = (numa_bound ? nodes : 1);
+
+  // Reserve the first segment of each partition of the heap.  A failure to do
+  // so is fatal.
+  for (int node = 0; node < numa_nodes; ++node) {
+    current_segments[node] = segment_create(SEGMENT_SIZE, numa_bound ? node : -1);
+    if (current_segments[node] == NULL) {
+      ERROR("Could not mmap() heap region");
+    }
+  }
+
+  // Likewise reserve the region for small pages, and split it among the
+  // partitions.  Being aligned to a huge page, it is also aligned to a small
+  // page.
+  intptr_t small = reserve(SMALL_REGION_SIZE * numa_nodes);
+  if (small == 0) {
+    ERROR("Could not mmap() small page region");
+  }
+  for (int node = 0; node < numa_nodes; ++node) {
+    region_s* region    = &small_regions[node];
+    region->start_addr  = small + node * SMALL_REGION_SIZE;
+    region->free_addr   = region->start_addr;
+    region->commit_addr = region->start_addr;
+    region->end_addr    = region->start_addr + SMALL_REGION_SIZE;
+    region->node        = (numa_bound ? node : -1);
+  }
+
+  // Fault in the start of each partition, if asked to.
+  const char* prefault_size = getenv(PREFAULT_ENV);
+  const char* ahead         = getenv(PREFAULT_AHEAD_ENV);
+  prefault_bytes = (prefault_size != NULL ? strtoull(prefault_size, NULL, 10) : 0);
+  prefault_ahead = (ahead != NULL ? strtoull(ahead, NULL, 10) : 0);
+  if (prefault_bytes > 0) {
+    for (int node = 0; node < numa_nodes; ++node) {
+      prefault(current_segments[node], 0, prefault_bytes);
+      prefault(&small_regions[node], 0, prefault_bytes);
+    }
+  }
+
+#if defined (PB_HARDENED)
+  guard_init();
+#endif
+
+  // Make the heap visible to every other thread.
+  __atomic_store_n(&heap_state, HEAP_READY, __ATOMIC_RELEASE);
+
+  // DEBUG: Emit a message to indicate that this allocator is being called.
+  DEBUG("bp-alloc initialized");
+
+} // init ()
+
+/**
+ * Initialize the heap as the library is loaded, so that the allocation fast
+ * paths never need to check.  Only the slow paths still call `init()`, for any
+ * allocation made by another library's constructor before this one runs.
+ */
+static void __attribute__ ((constructor)) init_at_load () {
+  init();
+  prefault_start();
+} // init_at_load ()
+// ==============================================================================
+
+
+// ==============================================================================
+/**
+ * Add the counts of one set of statistics to another.  The counts being added
+ * may belong to a running thread, and so are read atomically.
+ *
+ * \param total  The statistics to add to.
+ * \param counts The statistics to add.
+ */
+static void stats_add (pb_stats_t* total, pb_stats_t* counts) {
+
+  total->malloc_calls       += __atomic_load_n(&counts->malloc_calls,       __ATOMIC_RELAXED);
+  total->calloc_calls       += __atomic_load_n(&counts->calloc_calls,       __ATOMIC_RELAXED);
+  total->realloc_calls      += __atomic_load_n(&counts->realloc_calls,      __ATOMIC_RELAXED);
+  total->free_calls         += __atomic_load_n(&counts->free_calls,         __ATOMIC_RELAXED);
+  total->memalign_calls     += __atomic_load_n(&counts->memalign_calls,     __ATOMIC_RELAXED);
+  total->bytes_requested    += __atomic_load_n(&counts->bytes_requested,    __ATOMIC_RELAXED);
+  total->bytes_consumed     += __atomic_load_n(&counts->bytes_consumed,     __ATOMIC_RELAXED);
+  total->header_bytes       += __atomic_load_n(&counts->header_bytes,       __ATOMIC_RELAXED);
+  total->realloc_copy_bytes += __atomic_load_n(&counts->realloc_copy_bytes, __ATOMIC_RELAXED);
+
+} // stats_add ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Retire an exiting thread's statistics, folding them into the totals and
+ * taking them off the list.  Called as the destructor of the statistics key.
+ *
+ * \param arg The thread's statistics.
+ */
+static void stats_thread_exit (void* arg) {
+
+  thread_stats_s* stats = (thread_stats_s*)arg;
+
+  spin_lock(&stats_lock);
+  stats_add(&retired_stats, &stats->counts);
+  if (stats->prev == NULL) {
+    stats_list = stats->next;
+  } else {
+    stats->prev->next = stats->next;
+  }
+  if (stats->next != NULL) {
+    stats->next->prev = stats->prev;
+  }
+  spin_unlock(&stats_lock);
+
+  memset(&stats->counts, 0, sizeof(stats->counts));
+  stats->linked = false;
+
+} // stats_thread_exit ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The slow path for finding this thread's statistics: link them onto the list,
+ * the first time that the thread calls into the heap.  This is also when the
+ * thread takes up the heap's default policies.
+ */
+static void stats_link () {
+
+  init();
+  thread_isolate = isolate_default;
+
+  // Arrange (once) for each thread's statistics to be retired when it exits.
+  spin_lock(&stats_lock);
+  if (!stats_key_ready) {
+    pthread_key_create(&stats_key, stats_thread_exit);
+    stats_key_ready = true;
+  }
+  thread_stats.prev = NULL;
+  thread_stats.next = stats_list;
+  if (stats_list != NULL) {
+    stats_list->prev = &thread_stats;
+  }
+  stats_list = &thread_stats;
+  spin_unlock(&stats_lock);
+
+  thread_stats.linked = true;
+  pthread_setspecific(stats_key, &thread_stats);
+
+} // stats_link ()
+
+/**
+ * This thread's statistics, linked onto the list if they are not yet.
+ *
+ * \return The statistics' counts.
+ */
+static inline pb_stats_t* local_stats () {
+
+  if (!thread_stats.linked) {
+    stats_link();
+  }
+  return &thread_stats.counts;
+
+} // local_stats ()
+
+/**
+ * Count an allocation against this thread.
+ *
+ * \param requested The bytes requested.
+ * \param header    The bytes of header added.
+ * \param consumed  The bytes consumed in all, with header and padding.
+ */
+static inline void count_block (size_t requested, size_t header, size_t consumed) {
+
+  thread_stats.counts.bytes_requested += requested;
+  thread_stats.counts.header_bytes    += header;
+  thread_stats.counts.bytes_consumed  += consumed;
+
+} // count_block ()
+
+/**
+ * Count bytes claimed from (or, if negative, given back to) the heap's
+ * regions, raising the high-water mark to match.
+ *
+ * \param region The region.
+ * \param delta  The change in bytes claimed.
+ */
+static void count_claimed (region_s* region, intptr_t delta) {
+
+  if (region->node >= 0) {
+    __atomic_add_fetch(&node_heap_bytes[region->node], delta, __ATOMIC_RELAXED);
+  }
+  size_t bytes = __atomic_add_fetch(&heap_bytes, delta, __ATOMIC_RELAXED);
+  size_t high  = __atomic_load_n(&heap_high_water, __ATOMIC_RELAXED);
+  while (bytes > high &&
+	 !__atomic_compare_exchange_n(&heap_high_water,
+				      &high,
+				      bytes,
+				      true,
+				      __ATOMIC_RELAXED,
+				      __ATOMIC_RELAXED)) {
+  }
+
+} // count_claimed ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+// FORK HANDLERS
+
+/**
+ * Quiesce the heap before a `fork()`: finish initializing it, if another
+ * thread is doing so, and take every lock, in the order in which they nest.
+ */
+static void fork_prepare () {
+
+  init();
+  spin_lock(&heap_file_lock);
+  spin_lock(&open_arenas_lock);
+  spin_lock(&heap_list_lock);
+  spin_lock(&grow_lock);
+  spin_lock(&commit_lock);
+  spin_lock(&stats_lock);
+
+} // fork_prepare ()
+
+/** Release every lock in the parent, once the `fork()` is done. */
+static void fork_parent () {
+
+  spin_unlock(&stats_lock);
+  spin_unlock(&commit_lock);
+  spin_unlock(&grow_lock);
+  spin_unlock(&heap_list_lock);
+  spin_unlock(&open_arenas_lock);
+  spin_unlock(&heap_file_lock);
+
+} // fork_parent ()
+
+/**
+ * Reset the heap in the child of a `fork()`, in which only the forking thread
+ * survives.  The other threads' statistics can no longer change, and their
+ * threads will never exit to retire them, so retire them now.  Their TLABs and
+ * small pages are simply abandoned, as they would be at any refill.
+ */
+static void fork_child () {
+
+  thread_stats_s* current = stats_list;
+  while (current != NULL) {
+    thread_stats_s* next = current->next;
+    if (current != &thread_stats) {
+      stats_add(&retired_stats, &current->counts);
+      current->next   = NULL;
+      current->prev   = NULL;
+      current->linked = false;
+    }
+    current = next;
+  }
+  if (thread_stats.linked) {
+    thread_stats.next = NULL;
+    thread_stats.prev = NULL;
+    stats_list        = &thread_stats;
+  } else {
+    stats_list = NULL;
+  }
+
+  trace_fork_child();
+  fork_parent();
+
+  // The prefault thread, like every other, did not survive the fork.
+  prefault_start();
+
+} // fork_child ()
+
+/** Register the fork handlers, as the library is loaded. */
+static void __attribute__ ((constructor)) fork_setup () {
+  pthread_atfork(fork_prepare, fork_parent, fork_child);
+} // fork_setup ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+// HARDENING
+
+/**
+ * Seal a block's header, once its size and flags are set, by setting its
+ * canary.  Does nothing unless the build is hardened.
+ *
+ * \param header_ptr The block's header.
+ */
+static inline void header_seal (header_s* header_ptr) {
+
+#if defined (PB_HARDENED)
+  uint64_t mix = (((uint64_t)(uintptr_t)header_ptr ^ header_ptr->size ^
+		   ((uint64_t)header_ptr->flags << 48))
+		  * UINT64_C(0x9e3779b97f4a7c15));
+  header_ptr->canary = ((uint32_t)(mix >> 32) ^
+			(header_ptr->flags & HEADER_PERSISTENT ? 0 : canary_secret));
+#else
+  (void)header_ptr;
+#endif
+
+} // header_seal ()
+
+/**
+ * Check a block's header against its canary, reporting any corruption (or a
+ * pointer that was never a block).  Does nothing unless the build is hardened.
+ *
+ * \param header_ptr The block's header.
+ */
+static inline void header_check (header_s* header_ptr) {
+
+#if defined (PB_HARDENED)
+  uint32_t canary = header_ptr->canary;
+  header_seal(header_ptr);
+  if (__builtin_expect(header_ptr->canary != canary, false)) {
+    ERROR("Heap corruption: bad header before block: ",
+	  (intptr_t)header_ptr + sizeof(header_s));
+  }
+#else
+  (void)header_ptr;
+#endif
+
+} // header_check ()
+
+/**
+ * Void a block's canary as the block is freed, so that freeing it again is
+ * caught.  Does nothing unless the build is hardened.
+ *
+ * \param header_ptr The block's header.
+ */
+static inline void header_void (header_s* header_ptr) {
+
+#if defined (PB_HARDENED)
+  header_ptr->canary = ~header_ptr->canary;
+#else
+  (void)header_ptr;
+#endif
+
+} // header_void ()
+
+#if defined (PB_HARDENED)
+/**
+ * The start of a guard slot.
+ *
+ * \param slot The slot.
+ * \return     The address of its page.
+ */
+static inline intptr_t guard_slot_addr (size_t slot) {
+  return guard_pool + (2 * slot + 1) * PAGE_SIZE;
+} // guard_slot_addr ()
+
+/**
+ * Report a fault in the guard pool: an overflow onto a guard page, or a use of
+ * a freed slot.  A fault anywhere else is forwarded to the program's own
+ * handler, if it had one, by calling it directly, so that a handler that
+ * recovers (as a garbage collector's or a JIT's would) leaves guard sampling in
+ * place.  Only if the previous action was the default (or to ignore, which the
+ * kernel overrides for a fault) is it restored, and the fault taken again, or
+ * the signal raised again if it was sent, to end the process as it would have.
+ *
+ * \param signal  The signal, `SIGSEGV`.
+ * \param info    Where the fault occurred.
+ * \param context The interrupted context.
+ */
+static void guard_fault (int signal, siginfo_t* info, void* context) {
+
+  intptr_t addr = (intptr_t)info->si_addr;
+  intptr_t end  = guard_slot_addr(GUARD_SLOTS);
+  if (addr >= guard_pool && addr < end) {
+    size_t page = (addr - guard_pool) / PAGE_SIZE;
+    if (page % 2 == 0) {
+      ERROR("Heap corruption: access past a guarded block, at: ", addr);
+    }
+    ERROR("Heap corruption: use of a freed guarded block, at: ", addr);
+  }
+
+  if (guard_prev_action.sa_flags & SA_SIGINFO) {
+    guard_prev_action.sa_sigaction(signal, info, context);
+  } else if (guard_prev_action.sa_handler != SIG_DFL &&
+	     guard_prev_action.sa_handler != SIG_IGN) {
+    guard_prev_action.sa_handler(signal);
+  } else {
+    sigaction(SIGSEGV, &guard_prev_action, NULL);
+    if (info->si_code <= 0) {
+      raise(signal);
+    }
+  }
+
+} // guard_fault ()
+
+/**
+ * Set up hardening, as the heap is initialized: draw the canary secret from the
+ * random bytes that the kernel gives every process, and, if guard sampling is
+ * requested, reserve the guard pool and catch its faults.
+ */
+static void guard_init () {
+
+  const uint32_t* random = (const uint32_t*)getauxval(AT_RANDOM);
+  canary_secret = (random != NULL ? random[0] ^ random[3] : (uint32_t)time(NULL));
+
+  const char* rate = getenv(GUARD_RATE_ENV);
+  if (rate == NULL || strtoull(rate, NULL, 10) == 0) {
+    return;
+  }
+  void* pool = mmap(NULL,
+		    (2 * GUARD_SLOTS + 1) * PAGE_SIZE,
+		    PROT_NONE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+		    -1,
+		    0);
+  if (pool == MAP_FAILED) {
+    return;
+  }
+  guard_pool = (intptr_t)pool;
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = guard_fault;
+  action.sa_flags     = SA_SIGINFO | SA_ONSTACK;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGSEGV, &action, &guard_prev_action);
+  guard_rate = strtoull(rate, NULL, 10);
+
+} // guard_init ()
+
+/**
+ * The slow path of guard sampling, taken when this thread's countdown runs out.
+ * Draw the next interval, uniformly up to twice the rate, and place this block
+ * at the end of a free guard slot, if one is at hand and the block fits.
+ *
+ * \param size The number of bytes requested.
+ * \return     The guarded block, if one was allocated; `NULL` if the block
+ *             should instead be allocated as usual.
+ */
+static void* __attribute__ ((noinline)) guard_sample (size_t size) {
+
+  init();
+  if (guard_rate == 0) {
+    guard_countdown = INT64_MAX;
+    return NULL;
+  }
+
+  // A thread's first trip here only starts its countdown.
+  bool first = (guard_random == 0);
+  if (first) {
+    guard_random = ((uint64_t)(intptr_t)&guard_random ^ canary_secret) | 1;
+  }
+  guard_random ^= guard_random << 13;
+  guard_random ^= guard_random >> 7;
+  guard_random ^= guard_random << 17;
+  guard_countdown = (int64_t)(guard_random % (2 * guard_rate)) + 1;
+  if (first || size == 0 || size > PAGE_SIZE - sizeof(header_s) - ALIGNMENT) {
+    return NULL;
+  }
+
+  // Slots are reused round-robin, which keeps each freed one inaccessible for
+  // as long as possible.
+  size_t slot     = __atomic_fetch_add(&guard_cursor, 1, __ATOMIC_RELAXED) % GUARD_SLOTS;
+  int    expected = GUARD_FREE;
+  if (!__atomic_compare_exchange_n(&guard_states[slot],
+				   &expected,
+				   GUARD_USED,
+				   false,
+				   __ATOMIC_ACQUIRE,
+				   __ATOMIC_RELAXED)) {
+    return NULL;
+  }
+  intptr_t start = guard_slot_addr(slot);
+  if (mprotect((void*)start, PAGE_SIZE, PROT_READ | PROT_WRITE) != 0) {
+    __atomic_store_n(&guard_states[slot], GUARD_FREE, __ATOMIC_RELEASE);
+    return NULL;
+  }
+
+  // End the block as near to the guard page as its alignment allows.
+  intptr_t  block_addr = (start + PAGE_SIZE - size) & ~((intptr_t)ALIGNMENT - 1);
+  header_s* header_ptr = (header_s*)(block_addr - sizeof(header_s));
+  header_ptr->size  = size;
+  header_ptr->flags = HEADER_GUARDED;
+  header_seal(header_ptr);
+  count_block(size, sizeof(header_s), PAGE_SIZE);
+  return (void*)block_addr;
+
+} // guard_sample ()
+
+/**
+ * Free a guarded block: zero its slot and make it inaccessible, so that any
+ * later use of the block faults, until the slot is reused.
+ *
+ * \param header_ptr The block's header.
+ */
+static void guard_free (header_s* header_ptr) {
+
+  size_t slot     = ((intptr_t)header_ptr - guard_pool) / PAGE_SIZE / 2;
+  int    expected = GUARD_USED;
+  if (!__atomic_compare_exchange_n(&guard_states[slot],
+				   &expected,
+				   GUARD_RELEASING,
+				   false,
+				   __ATOMIC_ACQUIRE,
+				   __ATOMIC_RELAXED)) {
+    ERROR("Heap corruption: double free of a guarded block: ",
+	  (intptr_t)header_ptr + sizeof(header_s));
+  }
+  intptr_t start = guard_slot_addr(slot);
+  madvise((void*)start, PAGE_SIZE, MADV_DONTNEED);
+  mprotect((void*)start, PAGE_SIZE, PROT_NONE);
+  __atomic_store_n(&guard_states[slot], GUARD_FREE, __ATOMIC_RELEASE);
+
+} // guard_free ()
+#endif // PB_HARDENED
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Atomically claim space from a shared region, committing it if need be.  Takes
+ * `want` bytes if that many remain, or else whatever remains, so long as it is
+ * at least `need` bytes.
+ *
+ * \param region The region.
+ * \param need   The minimum number of bytes acceptable.
+ * \param want   The number of bytes preferred.
+ * \param got    Set to the number of bytes actually claimed.
+ * \return       The address of the claimed space, if successful; `0` if
+ *               unsuccessful.
+ */
+static intptr_t claim (region_s* region, size_t need, size_t want, size_t* got) {
+
+  intptr_t old_free_addr = __atomic_load_n(&region->free_addr, __ATOMIC_RELAXED);
+  size_t   claimed;
+  do {
+
+    // Take only what is left if the preferred amount does not fit.
+    size_t remaining = region->end_addr - old_free_addr;
+    if (remaining < need) {
+      return 0;
+    }
+    claimed = (remaining < want ? remaining : want);
+
+  } while (!__atomic_compare_exchange_n(&region->free_addr,
+					&old_free_addr,
+					old_free_addr + claimed,
+					true,
+					__ATOMIC_ACQUIRE,
+					__ATOMIC_RELAXED));
+
+  // The space is ours, but may lie past the watermark.
+  if (!commit(region, old_free_addr + claimed)) {
+    return 0;
+  }
+
+  count_claimed(region, claimed);
+  *got = claimed;
+  return old_free_addr;
+  
+} // claim ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Claim space from this thread's partition of the heap, growing it by a new
+ * segment if the current one is too full.  (See `claim()`.)
+ *
+ * \param need The minimum number of bytes acceptable.
+ * \param want The number of bytes preferred.
+ * \param got  Set to the number of bytes actually claimed.
+ * \return     The address of the claimed space, if successful; `0` if
+ *             unsuccessful.
+ */
+static intptr_t heap_claim (size_t need, size_t want, size_t* got) {
+
+  region_s** current = &current_segments[thread_node];
+  while (true) {
+
+    region_s* segment = __atomic_load_n(current, __ATOMIC_ACQUIRE);
+    intptr_t  space   = claim(segment, need, want, got);
+    if (space != 0) {
+      return space;
+    }
+
+    // Replace the segment, unless another thread already has.  Make the new
+    // segment large enough for this request, even if it is huge.
+    spin_lock(&grow_lock);
+    if (__atomic_load_n(current, __ATOMIC_RELAXED) == segment) {
+      size_t    header_size = ALIGN_UP(sizeof(region_s)) + ALIGNMENT;
+      size_t    size        = ROUND_UP(need + header_size, COMMIT_SIZE);
+      region_s* grown       = segment_create(size < SEGMENT_SIZE ? SEGMENT_SIZE : size,
+					     segment->node);
+      if (grown == NULL) {
+	spin_unlock(&grow_lock);
+	return 0;
+      }
+      grown->prev = segment;
+      __atomic_store_n(current, grown, __ATOMIC_RELEASE);
+    }
+    spin_unlock(&grow_lock);
+
+  }
+
+} // heap_claim ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The end of the dirty part (the part that may not be zeroed) of a span claimed
+ * from the heap.
+ *
+ * \param start The beginning of the span.
+ * \param end   The end of the span.
+ * \return      The end of the dirty part, between `start` and `end`.
+ */
+static intptr_t segment_dirty (intptr_t start, intptr_t end) {
+
+  // If the current segment has been replaced since the span was claimed, then
+  // assume the worst.
+  region_s* segment = __atomic_load_n(&current_segments[thread_node], __ATOMIC_ACQUIRE);
+  if (start < segment->start_addr || end > segment->end_addr) {
+    return end;
+  }
+
+  intptr_t dirty = __atomic_load_n(&segment->dirty_addr, __ATOMIC_RELAXED);
+  return (dirty < start ? start : (dirty > end ? end : dirty));
+
+} // segment_dirty ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The slow path for allocation, taken when a block does not fit in the current
+ * thread's TLAB.  The rest of that TLAB is abandoned, and a new TLAB is claimed
+ * to hold the block.
+ *
+ * \param total_size The size of the block, including its header and padding.
+ * \return           The address of the block's header, if successful; `0` if
+ *                   unsuccessful.
+ */
+static intptr_t tlab_refill (size_t total_size) {
+
+  init();
+  numa_locate();
+
+  // Claim a fresh TLAB.  Because its size is a multiple of the alignment, it
+  // begins with the same alignment invariant as the segment's free pointer.
+  size_t   got;
+  intptr_t tlab = heap_claim(total_size, TLAB_SIZE, &got);
+  if (tlab == 0) {
+    return 0;
+  }
+  __atomic_add_fetch(&node_refills[thread_node], 1, __ATOMIC_RELAXED);
+  DEBUG("New TLAB: ", tlab, got);
+  tlab_start = tlab;
+  tlab_free  = tlab + total_size;
+  tlab_end   = tlab + got;
+  tlab_dirty = segment_dirty(tlab, tlab_end);
+  return tlab;
+
+} // tlab_refill ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Move the free pointer of this thread's current segment from one address to
+ * another, but only if it is still at the first: that is, only if no other space has
+ * been claimed since.  Used to extend, or to give back, the space at the top of
+ * the segment.  Space given back is first marked as dirty.
+ *
+ * \param old_addr The address at which the free pointer is expected to be.
+ * \param new_addr The address to which to move it.
+ * \return         `true` if the free pointer was moved; `false` otherwise.
+ */
+static bool segment_move_top (intptr_t old_addr, intptr_t new_addr) {
+
+  region_s* segment = __atomic_load_n(&current_segments[thread_node], __ATOMIC_ACQUIRE);
+  if (segment == NULL ||
+      new_addr > segment->end_addr ||
+      !commit(segment, new_addr)) {
+    return false;
+  }
+
+  // Raise the dirty mark before giving the space back, so that any thread that
+  // then claims the space sees the mark, too.
+  if (new_addr < old_addr) {
+    intptr_t dirty = __atomic_load_n(&segment->dirty_addr, __ATOMIC_RELAXED);
+    while (dirty < old_addr &&
+	   !__atomic_compare_exchange_n(&segment->dirty_addr,
+					&dirty,
+					old_addr,
+					true,
+					__ATOMIC_RELAXED,
+					__ATOMIC_RELAXED)) {
+    }
+  }
+
+  if (!__atomic_compare_exchange_n(&segment->free_addr,
+				   &old_addr,
+				   new_addr,
+				   false,
+				   __ATOMIC_ACQ_REL,
+				   __ATOMIC_RELAXED)) {
+    return false;
+  }
+  count_claimed(segment, new_addr - old_addr);
+  return true;
+
+} // segment_move_top ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Grow a headered block in place, if it is the most recent one claimed from the
+ * top of either this thread's TLAB or the current segment.
+ *
+ * \param header_ptr The block's header.
+ * \param size       The new size of the block, larger than its current size.
+ * \return           `true` if the block was grown; `false` otherwise.
+ */
+static bool grow_in_place (header_s* header_ptr, size_t size) {
+
+  intptr_t header_addr = (intptr_t)header_ptr;
+  intptr_t old_end     = header_addr + ALIGN_UP(header_ptr->size + sizeof(header_s));
+  intptr_t new_end     = header_addr + ALIGN_UP(size + sizeof(header_s));
+
+  if (old_end == tlab_free && header_addr >= tlab_start) {
+
+    // The block is the last in this thread's TLAB.  If it still fits, just
+    // bump.  If not, but the TLAB is the last space claimed from the segment,
+    // extend the TLAB, too.
+    if (new_end <= tlab_end) {
+      tlab_free = new_end;
+    } else if (segment_move_top(tlab_end, new_end)) {
+      tlab_free = new_end;
+      tlab_end  = new_end;
+    } else {
+      return false;
+    }
+
+  } else if (!segment_move_top(old_end, new_end)) {
+    return false;
+  }
+
+  header_ptr->size = size;
+  header_seal(header_ptr);
+  return true;
+
+} // grow_in_place ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The length of the mapping that holds a block with its own mapping.  The
+ * header lies within the mapping's first page (at its start, unless the block
+ * needed more than the usual alignment), so the mapping starts at that page.
+ *
+ * \param header_addr The address (or just the offset within its page) of the
+ *                    block's header.
+ * \param size        The size of the block, in bytes.
+ * \return            The length of its mapping, in bytes.
+ */
+static inline size_t mapped_length (intptr_t header_addr, size_t size) {
+  return ROUND_UP((header_addr & (PAGE_SIZE - 1)) + size + sizeof(header_s), PAGE_SIZE);
+} // mapped_length ()
+
+/**
+ * The start of the mapping that holds a block with its own mapping.
+ *
+ * \param header_ptr The block's header.
+ * \return           The start of its mapping.
+ */
+static inline void* mapping_of (header_s* header_ptr) {
+  return (void*)((intptr_t)header_ptr & ~(PAGE_SIZE - 1));
+} // mapping_of ()
+
+/**
+ * The address of a header such that the block after it is aligned, as near
+ * after a given address as possible.
+ *
+ * \param addr      The earliest address for the header.
+ * \param alignment The alignment of the block, a power of two of at least
+ *                  `ALIGNMENT`.
+ * \return          The address of the header.
+ */
+static inline intptr_t aligned_header (intptr_t addr, size_t alignment) {
+  return ROUND_UP(addr + sizeof(header_s), alignment) - sizeof(header_s);
+} // aligned_header ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a block too large to share a TLAB.  Blocks above the mapping
+ * threshold (and any that need more than page alignment) are given their own
+ * mapping, with the header in its first page; others are claimed directly from
+ * the heap.
+ *
+ * \param alignment The alignment of the block, a power of two of at least
+ *                  `ALIGNMENT`.
+ * \param size      The number of bytes to allocate.
+ * \return          A pointer to the allocated block, if successful; `NULL` if
+ *                  unsuccessful.
+ */
+static void* large_malloc (size_t alignment, size_t size) {
+
+  init();
+
+  header_s* header_ptr;
+  if (size >= mmap_threshold || alignment > (size_t)PAGE_SIZE) {
+
+    // Within a page, alignment needs only an offset into the mapping.  Beyond
+    // that, over-map, and trim the mapping to start a page before an aligned
+    // address.
+    size_t offset = (alignment <= (size_t)PAGE_SIZE ? alignment : (size_t)PAGE_SIZE)
+                    - sizeof(header_s);
+    size_t length = mapped_length(alignment == ALIGNMENT ? 0 : offset, size);
+    size_t excess = (alignment > (size_t)PAGE_SIZE ? alignment : 0);
+    void*  map    = mmap(NULL,
+			 length + excess,
+			 PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS,
+			 -1,
+			 0);
+    if (map == MAP_FAILED) {
+      return NULL;
+    }
+    intptr_t start = (intptr_t)map;
+    if (excess != 0) {
+      start = ROUND_UP(start + PAGE_SIZE, alignment) - PAGE_SIZE;
+      if (start > (intptr_t)map) {
+	munmap(map, start - (intptr_t)map);
+      }
+      munmap((void*)(start + length), (intptr_t)map + length + excess - (start + length));
+    }
+    if (numa_bound) {
+      numa_locate();
+      numa_bind(start, length, thread_node);
+    }
+    header_ptr        = (header_s*)(alignment == ALIGNMENT ? start : start + offset);
+    header_ptr->flags = HEADER_MAPPED;
+    __atomic_add_fetch(&mapped_bytes, length, __ATOMIC_RELAXED);
+    count_block(size, sizeof(header_s), length);
+
+  } else {
+
+    // Claim enough extra to align the block, and place its header to suit.
+    size_t   got;
+    size_t   total = ALIGN_UP(size + sizeof(header_s)) + (alignment - ALIGNMENT);
+    intptr_t space = heap_claim(total, total, &got);
+    if (space == 0) {
+      return NULL;
+    }
+    header_ptr        = (header_s*)aligned_header(space, alignment);
+    header_ptr->flags = 0;
+    count_block(size, sizeof(header_s), got);
+
+  }
+
+  header_ptr->size = size;
+  header_seal(header_ptr);
+  return (void*)((intptr_t)header_ptr + sizeof(header_s));
+
+} // large_malloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The slow path for small allocation, taken when the current thread's page for
+ * a class is full.  Claims a new small page for that class and returns its
+ * first block.
+ *
+ * \param class The size class.
+ * \return      The new block, if successful; `0` if the small page region has
+ *              been exhausted.
+ */
+static intptr_t small_refill (int class) {
+
+  init();
+  numa_locate();
+
+  size_t   got;
+  intptr_t page_addr = claim(&small_regions[thread_node], SMALL_PAGE_SIZE, SMALL_PAGE_SIZE, &got);
+  if (page_addr == 0) {
+    return 0;
+  }
+  __atomic_add_fetch(&node_refills[thread_node], 1, __ATOMIC_RELAXED);
+
+  size_t  block_size = (class + 1) * ALIGNMENT;
+  page_s* page_ptr   = (page_s*)page_addr;
+  page_ptr->block_size = block_size;
+
+  // Leave off any tail too short to hold another block.
+  intptr_t block_addr = page_addr + sizeof(page_s);
+  small_free[class]   = block_addr + block_size;
+  small_dirty[class]  = block_addr;
+  small_end[class]    = page_addr + SMALL_PAGE_SIZE
+                        - (SMALL_PAGE_SIZE - sizeof(page_s)) % block_size;
+  return block_addr;
+
+} // small_refill ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Whether a block is a headerless one, from a small page.
+ *
+ * \param ptr The block.
+ * \return    `true` if the block lies in the small page region.
+ */
+static inline bool is_small (void* ptr) {
+  return ((intptr_t)ptr >= small_regions[0].start_addr &&
+	  (intptr_t)ptr <  small_regions[numa_nodes - 1].end_addr);
+} // is_small ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The header of a block that has one (i.e., is not small).
+ *
+ * \param ptr The block.
+ * \return    The block's header.
+ */
+static inline header_s* header_of (void* ptr) {
+  return (header_s*)((intptr_t)ptr - sizeof(header_s));
+} // header_of ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The number of usable bytes in a block: for a small block, the size of its
+ * page's class; otherwise, the size in its header.
+ *
+ * \param ptr The block.
+ * \return    The block's size.
+ */
+static size_t block_size (void* ptr) {
+
+  if (is_small(ptr)) {
+    page_s* page_ptr = (page_s*)((intptr_t)ptr & ~(SMALL_PAGE_SIZE - 1));
+    return page_ptr->block_size;
+  }
+
+  return header_of(ptr)->size;
+
+} // block_size ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The number of usable bytes in a block, which may be more than were requested.
+ *
+ * \param ptr The block.
+ * \return    The block's size; `0` if `ptr` is `NULL`.
+ */
+size_t malloc_usable_size (void* ptr) {
+  return (ptr == NULL ? 0 : block_size(ptr));
+} // malloc_usable_size ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Draw the number of bytes until this thread's next sample, from a geometric
+ * distribution (approximated by an exponential one) whose mean is the sampling
+ * rate.
+ *
+ * \return The interval, in bytes.
+ */
+static int64_t prof_interval () {
+
+  // Advance the thread's xorshift generator, seeding it on first use.
+  if (prof_random == 0) {
+    prof_random = ((uint64_t)(intptr_t)&prof_random ^ (uint64_t)time(NULL)) | 1;
+  }
+  prof_random ^= prof_random << 13;
+  prof_random ^= prof_random >> 7;
+  prof_random ^= prof_random << 17;
+
+  // Take 53 random bits as a uniform value in (0, 1].
+  double uniform = ((prof_random >> 11) + 1) * (1.0 / (UINT64_C(1) << 53));
+  return (int64_t)(-log(uniform) * prof_rate) + 1;
+
+} // prof_interval ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The slow path of sampling, taken when this thread's countdown runs out.  Draw
+ * the next interval, and record the call stack of the allocation that ran it
+ * out.  Capturing the stack may itself allocate (the first `backtrace()` loads
+ * the unwinder), but those allocations are never sampled.
+ *
+ * \param size The number of bytes requested.
+ */
+static void __attribute__ ((noinline)) prof_sample (size_t size) {
+
+  if (prof_busy) {
+    return;
+  }
+  init();
+  if (prof_rate == 0) {
+    prof_countdown = INT64_MAX;
+    return;
+  }
+
+  // A thread's first trip here only starts its countdown.
+  bool first = (prof_random == 0);
+  prof_countdown = prof_interval();
+  if (first) {
+    return;
+  }
+
+  size_t index = __atomic_fetch_add(&prof_used, 1, __ATOMIC_RELAXED);
+  if (index >= PROF_MAX_SAMPLES) {
+    return;
+  }
+  prof_busy = true;
+  prof_sample_s* sample = &prof_samples[index];
+  int            depth  = backtrace(sample->stack, PROF_MAX_DEPTH);
+  sample->size = size;
+  __atomic_store_n(&sample->depth, (depth > 0 ? depth : 1), __ATOMIC_RELEASE);
+  prof_busy = false;
+
+} // prof_sample ()
+
+/**
+ * Count an allocation against this thread's sampling countdown, and sample it
+ * if it runs the countdown out.
+ *
+ * \param size The number of bytes requested.
+ */
+static inline void prof_count (size_t size) {
+
+  prof_countdown -= size;
+  if (__builtin_expect(prof_countdown < 0, false)) {
+    prof_sample(size);
+  }
+
+} // prof_count ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+// Aligned allocation, defined below, may be needed by allocation in general.
+static void* aligned_allocate (size_t alignment, size_t size);
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The slow path for allocation, taken by any request that the fast path (see
+ * `allocate()`) cannot serve.  Expand into the current thread's TLAB via
+ * _pointer bumping_, touching the shared heap region only when that TLAB is
+ * exhausted, or when the block is too large to share one.
+ *
+ * A block that this thread isolates is padded to whole cache lines.  If it is
+ * small, that puts it in a class whose blocks all start on a cache line (since
+ * the page header fills one); if not, it is aligned to a cache line, too.
+ *
+ * \param size The number of bytes to allocate.
+ * \return     A pointer to the allocated block, if successful; `NULL` if
+ *             unsuccessful.
+ */
+static void* __attribute__ ((noinline)) allocate_slow (size_t size) {
+
+  // Reject empty requests, as well as any so large that they could not fit
+  // (which also keeps the arithmetic below from overflowing).
+  if (size == 0 || size > MAX_REQUEST_SIZE) {
+    return NULL;
+  }
+
+  size_t usable = size;
+  if (__builtin_expect(size <= thread_isolate, false)) {
+    usable = ROUND_UP(size, CACHE_LINE_SIZE);
+    if (usable > SMALL_MAX_SIZE) {
+      void* block_ptr = aligned_allocate(CACHE_LINE_SIZE, usable);
+      if (block_ptr != NULL) {
+	thread_stats.counts.bytes_requested -= usable - size;
+      }
+      return block_ptr;
+    }
+  }
+
+  prof_count(size);
+
+  // Small blocks come, headerless, from this thread's page for their class.
+  // Only if the small page region runs out do they fall back to the TLAB.
+  if (usable <= SMALL_MAX_SIZE) {
+    int      class      = (usable - 1) / ALIGNMENT;
+    size_t   class_size = (class + 1) * ALIGNMENT;
+    intptr_t block_addr = small_free[class];
+    if (class_size <= (size_t)(small_end[class] - block_addr)) {
+      small_free[class] = block_addr + class_size;
+      count_block(size, 0, class_size);
+      return (void*)block_addr;
+    }
+    block_addr = small_refill(class);
+    if (block_addr != 0) {
+      count_block(size, 0, class_size);
+      return (void*)block_addr;
+    }
+  }
+
+  if (size > TLAB_MAX_BLOCK - sizeof(header_s)) {
+    return large_malloc(ALIGNMENT, size);
+  }
+
+  // Account for the header, then round the whole block up to the alignment.
+  // Because every block is a multiple of the alignment, the free pointer keeps
+  // its alignment invariant, and the padding is folded into the block itself.
+  size_t   total_size  = ALIGN_UP(size + sizeof(header_s));
+  intptr_t header_addr = tlab_free;
+  if (total_size <= (size_t)(tlab_end - tlab_free)) {
+    tlab_free = header_addr + total_size;
+  } else {
+    header_addr = tlab_refill(total_size);
+    if (header_addr == 0) {
+      return NULL;
+    }
+  }
+
+  // The header sits at the start of the claimed space, with the block after it.
+  header_s* header_ptr = (header_s*)header_addr;
+  void*     block_ptr  = (void*)(header_addr + sizeof(header_s));
+  header_ptr->size  = size;
+  header_ptr->flags = 0;
+  header_seal(header_ptr);
+  count_block(size, sizeof(header_s), total_size);
+  return block_ptr;
+
+} // allocate_slow ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate and return `size` bytes of heap space.  Shared by every entry
+ * point, each of which counts only its own call.  The fast path, inlined into
+ * each of them, serves the common case: a small block, neither isolated nor due
+ * to be sampled, bumped from this thread's page for its class.  Everything
+ * else takes the slow path.
+ *
+ * \param size The number of bytes to allocate.
+ * \return     A pointer to the allocated block, if successful; `NULL` if
+ *             unsuccessful.
+ */
+static inline __attribute__ ((always_inline)) void* allocate (size_t size) {
+
+#if defined (PB_HARDENED)
+  if (__builtin_expect(--guard_countdown < 0, false)) {
+    void* block_ptr = guard_sample(size);
+    if (block_ptr != NULL) {
+      return block_ptr;
+    }
+  }
+#endif
+
+  // An empty request wraps around to a huge class, and so takes the slow path.
+  size_t class = (size - 1) / ALIGNMENT;
+  if (__builtin_expect(class < SMALL_CLASSES && size > thread_isolate, true)) {
+    size_t   class_size = (class + 1) * ALIGNMENT;
+    intptr_t block_addr = small_free[class];
+    int64_t  countdown  = prof_countdown - (int64_t)size;
+    if (__builtin_expect(class_size <= (size_t)(small_end[class] - block_addr) &&
+			 countdown >= 0, true)) {
+      small_free[class] = block_addr + class_size;
+      prof_countdown    = countdown;
+      count_block(size, 0, class_size);
+      return (void*)block_addr;
+    }
+  }
+  return allocate_slow(size);
+
+} // allocate ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate and return `size` bytes of heap space.
+ *
+ * \param size The number of bytes to allocate.
+
+ * \return A pointer to the allocated block, if successful; `NULL` if
+ *         unsuccessful.
+ */
+void* malloc (size_t size) {
+
+  local_stats()->malloc_calls += 1;
+  void* block_ptr = allocate(size);
+  TRACE(TRACE_MALLOC, block_ptr, size, 0);
+  return block_ptr;
+
+} // malloc()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `size` bytes of heap space, aligned to a multiple of `alignment`.
+ * This is just as `allocate()` does, but with the padding before the header
+ * generalized: the header is placed so that the block after it is aligned, and
+ * any space skipped before it is simply left unused.  (Small blocks are never
+ * used, since their pages do not align them.)
+ *
+ * \param alignment The alignment, a power of two.
+ * \param size      The number of bytes to allocate.
+ * \return          A pointer to the allocated block, if successful; `NULL` if
+ *                  unsuccessful.
+ */
+static void* aligned_allocate (size_t alignment, size_t size) {
+
+  if (alignment <= ALIGNMENT) {
+    return allocate(size);
+  }
+  if (size == 0 || size > MAX_REQUEST_SIZE || alignment > MAX_REQUEST_SIZE / 2) {
+    return NULL;
+  }
+  prof_count(size);
+
+  // Blocks that will fit in a TLAB, even after the worst-case padding, go
+  // there.  Rather than abandon the TLAB when it is short, refill it with
+  // room for that padding.
+  size_t block_total = ALIGN_UP(size + sizeof(header_s));
+  size_t worst_total = block_total + alignment - ALIGNMENT;
+  if (worst_total > TLAB_MAX_BLOCK) {
+    return large_malloc(alignment, size);
+  }
+  intptr_t start       = tlab_free;
+  intptr_t header_addr = aligned_header(start, alignment);
+  if (header_addr + block_total > tlab_end) {
+    start = tlab_refill(worst_total);
+    if (start == 0) {
+      return NULL;
+    }
+    header_addr = aligned_header(start, alignment);
+  }
+  tlab_free = header_addr + block_total;
+
+  header_s* header_ptr = (header_s*)header_addr;
+  header_ptr->size  = size;
+  header_ptr->flags = 0;
+  header_seal(header_ptr);
+  count_block(size, sizeof(header_s), tlab_free - start);
+  return (void*)(header_addr + sizeof(header_s));
+
+} // aligned_allocate ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `size` bytes, aligned to `alignment`, storing the block in `memptr`.
+ *
+ * \param memptr    Set to the allocated block, if successful.
+ * \param alignment The alignment, a power of two multiple of `sizeof(void*)`.
+ * \param size      The number of bytes to allocate.
+ * \return          `0` if successful; `EINVAL` if the alignment is invalid;
+ *                  `ENOMEM` if the block could not be allocated.
+ */
+int posix_memalign (void** memptr, size_t alignment, size_t size) {
+
+  local_stats()->memalign_calls += 1;
+  if (!IS_POWER_OF_TWO(alignment) || alignment % sizeof(void*) != 0) {
+    return EINVAL;
+  }
+
+  // As with `malloc()`, an empty request yields `NULL`.
+  void* block_ptr = aligned_allocate(alignment, size);
+  TRACE(TRACE_MEMALIGN, block_ptr, size, alignment);
+  if (block_ptr == NULL && size != 0) {
+    return ENOMEM;
+  }
+  *memptr = block_ptr;
+  return 0;
+
+} // posix_memalign ()
+
+/**
+ * Allocate `size` bytes, aligned to `alignment`.
+ *
+ * \param alignment The alignment, a power of two.
+ * \param size      The number of bytes to allocate.
+ * \return          A pointer to the allocated block, if successful; `NULL` if
+ *                  unsuccessful.
+ */
+void* aligned_alloc (size_t alignment, size_t size) {
+
+  local_stats()->memalign_calls += 1;
+  if (!IS_POWER_OF_TWO(alignment)) {
+    errno = EINVAL;
+    return NULL;
+  }
+  void* block_ptr = aligned_allocate(alignment, size);
+  TRACE(TRACE_MEMALIGN, block_ptr, size, alignment);
+  return block_ptr;
+
+} // aligned_alloc ()
+
+/**
+ * Allocate `size` bytes, aligned to `alignment`, which (as in glibc) is rounded
+ * up to a power of two if it is not one.
+ *
+ * \param alignment The alignment.
+ * \param size      The number of bytes to allocate.
+ * \return          A pointer to the allocated block, if successful; `NULL` if
+ *                  unsuccessful.
+ */
+void* memalign (size_t alignment, size_t size) {
+
+  local_stats()->memalign_calls += 1;
+  size_t power = ALIGNMENT;
+  while (power < alignment && power <= MAX_REQUEST_SIZE / 2) {
+    power <<= 1;
+  }
+  void* block_ptr = aligned_allocate(power, size);
+  TRACE(TRACE_MEMALIGN, block_ptr, size, power);
+  return block_ptr;
+
+} // memalign ()
+
+/**
+ * Allocate `size` bytes, aligned to a page.
+ *
+ * \param size The number of bytes to allocate.
+ * \return     A pointer to the allocated block, if successful; `NULL` if
+ *             unsuccessful.
+ */
+void* valloc (size_t size) {
+
+  init();
+  return memalign(PAGE_SIZE, size);
+
+} // valloc ()
+
+/**
+ * Allocate `size` bytes, rounded up to a whole number of pages, and aligned to
+ * a page.
+ *
+ * \param size The number of bytes to allocate.
+ * \return     A pointer to the allocated block, if successful; `NULL` if
+ *             unsuccessful.
+ */
+void* pvalloc (size_t size) {
+
+  if (size > MAX_REQUEST_SIZE) {
+    return NULL;
+  }
+  init();
+  return memalign(PAGE_SIZE, ROUND_UP(size, PAGE_SIZE));
+
+} // pvalloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Set the largest block that the calling thread isolates on its own cache
+ * lines.
+ *
+ * \param max_size The size, in bytes.
+ */
+void pb_isolate (size_t max_size) {
+
+  // Take up the defaults first, so that they do not later replace this.
+  local_stats();
+  thread_isolate = (max_size < MAX_REQUEST_SIZE ? max_size : MAX_REQUEST_SIZE);
+
+} // pb_isolate ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Deallocate a given block on the heap.  Blocks in the heap are generally never
+ * re-used (and blocks from an arena are left to be released with the rest of
+ * the arena), but a block with its own mapping is unmapped, and the most recent
+ * block from this thread's TLAB, its current small page, or the current
+ * segment is given back by rolling the free pointer back over it.
+ *
+ * \param ptr A pointer to the block to be deallocated.
+ */
+static inline void deallocate (void* ptr) {
+
+  if (ptr == NULL) {
+    return;
+  }
+
+  // Only this thread's pages can have a free pointer just past the block.
+  if (is_small(ptr)) {
+    intptr_t block_addr = (intptr_t)ptr;
+    size_t   size       = block_size(ptr);
+    int      class      = size / ALIGNMENT - 1;
+    if (block_addr + size == small_free[class]) {
+      small_free[class]  = block_addr;
+      small_dirty[class] = (small_dirty[class] > block_addr + size ?
+			    small_dirty[class] : block_addr + size);
+    }
+    return;
+  }
+
+  header_s* header_ptr = header_of(ptr);
+  header_check(header_ptr);
+  header_void(header_ptr);
+#if defined (PB_HARDENED)
+  if (header_ptr->flags & HEADER_GUARDED) {
+    guard_free(header_ptr);
+    return;
+  }
+#endif
+  if (header_ptr->flags & HEADER_MAPPED) {
+    size_t length = mapped_length((intptr_t)header_ptr, header_ptr->size);
+    __atomic_sub_fetch(&mapped_bytes, length, __ATOMIC_RELAXED);
+    munmap(mapping_of(header_ptr), length);
+    return;
+  }
+  if (header_ptr->flags & HEADER_ARENA) {
+    return;
+  }
+
+  intptr_t header_addr = (intptr_t)header_ptr;
+  intptr_t end_addr    = header_addr + ALIGN_UP(header_ptr->size + sizeof(header_s));
+  if (end_addr == tlab_free && header_addr >= tlab_start) {
+    tlab_free  = header_addr;
+    tlab_dirty = (tlab_dirty > end_addr ? tlab_dirty : end_addr);
+  } else {
+    segment_move_top(end_addr, header_addr);
+  }
+
+} // deallocate ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Deallocate a given block on the heap.
+ *
+ * \param ptr A pointer to the block to be deallocated.
+ */
+void free (void* ptr) {
+
+  DEBUG("free(): ", (intptr_t)ptr);
+
+  local_stats()->free_calls += 1;
+  TRACE(TRACE_FREE, ptr, 0, 0);
+  deallocate(ptr);
+
+} // free()
+// ==============================================================================
+
+
+// ==============================================================================
+/**
+ * Deallocate a block whose size is known, as C23's `free_sized()`.  The size
+ * cannot spare reading the block's header (or its small page's), which still
+ * says how the block was allocated, and whether it may be reclaimed.
+ *
+ * \param ptr  A pointer to the block to be deallocated.
+ * \param size The size requested when the block was allocated.
+ */
+void free_sized (void* ptr, size_t size) {
+
+  local_stats()->free_calls += 1;
+  TRACE(TRACE_FREE, ptr, size, 0);
+  deallocate(ptr);
+
+} // free_sized ()
+
+/**
+ * Deallocate an aligned block whose size is known, as C23's
+ * `free_aligned_sized()`.
+ *
+ * \param ptr       A pointer to the block to be deallocated.
+ * \param alignment The alignment requested when the block was allocated.
+ * \param size      The size requested when the block was allocated.
+ */
+void free_aligned_sized (void* ptr, size_t alignment, size_t size) {
+
+  local_stats()->free_calls += 1;
+  TRACE(TRACE_FREE, ptr, size, alignment);
+  deallocate(ptr);
+
+} // free_aligned_sized ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The number of blocks of a batch that may be bumped at once from the space
+ * between `free_addr` and `end_addr`, without running out this thread's
+ * sampling countdown.
+ *
+ * \param free_addr  The free pointer of the TLAB or small page.
+ * \param end_addr   Its end.
+ * \param block_size The whole size of each block, with any header and padding.
+ * \param size       The number of bytes requested for each block.
+ * \param count      The number of blocks still wanted.
+ * \return           The number of blocks, up to `count`; `0` if the next block
+ *                   must take the slow path.
+ */
+static inline size_t batch_fit (intptr_t free_addr,
+				intptr_t end_addr,
+				size_t   block_size,
+				size_t   size,
+				size_t   count) {
+
+  size_t fit     = (size_t)(end_addr - free_addr) / block_size;
+  size_t sampled = (prof_countdown > 0 ? (size_t)prof_countdown / size : 0);
+  fit = (fit < sampled ? fit : sampled);
+  return (fit < count ? fit : count);
+
+} // batch_fit ()
+
+/**
+ * Allocate `count` blocks of `size` bytes each.  Each run of blocks that fits
+ * in this thread's small page for their class (or, for larger blocks, in its
+ * TLAB) is claimed with a single bump of the free pointer, and the headers of
+ * the run, if any, are written in a tight loop.  Only the block that starts
+ * each run takes the slow path, to refill the page or TLAB, or to be sampled.
+ * Requests that are isolated, or too large for a TLAB, are allocated one at a
+ * time.
+ *
+ * \param size  The number of bytes in each block.
+ * \param count The number of blocks to allocate.
+ * \param out   Filled with the blocks, in order.
+ * \return      The number of blocks allocated.
+ */
+size_t pb_malloc_batch (size_t size, size_t count, void** out) {
+
+  pb_stats_t* stats = local_stats();
+  size_t      done  = 0;
+
+  if (size == 0 || size > TLAB_MAX_BLOCK - sizeof(header_s) || size <= thread_isolate) {
+
+    for (; done < count; ++done) {
+      if ((out[done] = allocate(size)) == NULL) {
+	break;
+      }
+    }
+
+  } else if (size <= SMALL_MAX_SIZE) {
+
+    int    class      = (size - 1) / ALIGNMENT;
+    size_t class_size = (class + 1) * ALIGNMENT;
+    while (done < count) {
+      intptr_t block_addr = small_free[class];
+      size_t   run        = batch_fit(block_addr, small_end[class], class_size, size, count - done);
+      if (run == 0) {
+	if ((out[done] = allocate_slow(size)) == NULL) {
+	  break;
+	}
+	done += 1;
+	continue;
+      }
+      for (size_t i = 0; i < run; ++i) {
+	out[done + i] = (void*)(block_addr + i * class_size);
+      }
+      small_free[class] = block_addr + run * class_size;
+      prof_countdown   -= run * size;
+      count_block(run * size, 0, run * class_size);
+      done += run;
+    }
+
+  } else {
+
+    size_t total_size = ALIGN_UP(size + sizeof(header_s));
+    while (done < count) {
+      intptr_t header_addr = tlab_free;
+      size_t   run         = batch_fit(header_addr, tlab_end, total_size, size, count - done);
+      if (run == 0) {
+	if ((out[done] = allocate_slow(size)) == NULL) {
+	  break;
+	}
+	done += 1;
+	continue;
+      }
+      for (size_t i = 0; i < run; ++i) {
+	header_s* header_ptr = (header_s*)(header_addr + i * total_size);
+	header_ptr->size  = size;
+	header_ptr->flags = 0;
+	header_seal(header_ptr);
+	out[done + i]     = (void*)(header_ptr + 1);
+      }
+      tlab_free       = header_addr + run * total_size;
+      prof_countdown -= run * size;
+      count_block(run * size, run * sizeof(header_s), run * total_size);
+      done += run;
+    }
+
+  }
+
+  stats->malloc_calls += done;
+  if (__builtin_expect(trace_state != TRACE_OFF, false)) {
+    for (size_t i = 0; i < done; ++i) {
+      TRACE(TRACE_MALLOC, out[i], size, 0);
+    }
+  }
+  return done;
+
+} // pb_malloc_batch ()
+
+/**
+ * Deallocate `count` blocks, from last to first.  Freeing a batch in that
+ * order rolls each free pointer back over the whole batch, wherever the batch
+ * is still the most recent allocation.
+ *
+ * \param ptrs  The blocks.
+ * \param count The number of blocks.
+ */
+void pb_free_batch (void** ptrs, size_t count) {
+
+  local_stats()->free_calls += count;
+  for (size_t i = count; i > 0; --i) {
+    TRACE(TRACE_FREE, ptrs[i - 1], 0, 0);
+    deallocate(ptrs[i - 1]);
+  }
+
+} // pb_free_batch ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The end of the dirty part of a block that was just allocated by this thread:
+ * that is, the part that has been used before, and so may not be zeroed.
+ *
+ * \param ptr The block.
+ * \return    The end of the block's dirty part, which may lie before the
+ *            block's start (if it all is clean) or after its end (if it all is
+ *            dirty).
+ */
+static intptr_t dirty_end (void* ptr) {
+
+  // A new block always comes from this thread's current small page or TLAB,
+  // its own mapping, or the top of the current segment.
+  if (is_small(ptr)) {
+    return small_dirty[block_size(ptr) / ALIGNMENT - 1];
+  }
+
+  header_s* header_ptr  = header_of(ptr);
+  intptr_t  header_addr = (intptr_t)header_ptr;
+  if (header_ptr->flags & (HEADER_MAPPED | HEADER_GUARDED)) {
+    return 0;
+  }
+  if (header_addr >= tlab_start && header_addr < tlab_end) {
+    return tlab_dirty;
+  }
+  return segment_dirty(header_addr,
+		       header_addr + ALIGN_UP(header_ptr->size + sizeof(header_s)));
+
+} // dirty_end ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a block of `nmemb * size` bytes on the heap, zeroing its contents.
+ * Space that has never before been allocated is already zeroed (by the kernel,
+ * when first touched), so only a block's dirty part is cleared.  That leaves
+ * untouched the pages of a large, fresh block.
+ *
+ * \param nmemb The number of elements in the new block.
+ * \param size  The size, in bytes, of each of the `nmemb` elements.
+ * \return      A pointer to the newly allocated and zeroed block, if successful;
+ *              `NULL` if unsuccessful.
+ */
+void* calloc (size_t nmemb, size_t size) {
+
+  local_stats()->calloc_calls += 1;
+
+  // Refuse requests whose total size overflows.
+  size_t block_size;
+  if (__builtin_mul_overflow(nmemb, size, &block_size)) {
+    return NULL;
+  }
+
+  // Allocate a block of the requested size.
+  void* block_ptr = allocate(block_size);
+
+  // If the allocation succeeded, clear whatever part of the block may be dirty.
+  if (block_ptr != NULL) {
+    intptr_t dirty = dirty_end(block_ptr);
+    if (dirty > (intptr_t)block_ptr) {
+      size_t dirty_size = dirty - (intptr_t)block_ptr;
+      memset(block_ptr, 0, (dirty_size < block_size ? dirty_size : block_size));
+    }
+  }
+
+  TRACE(TRACE_CALLOC, block_ptr, block_size, nmemb);
+  return block_ptr;
+  
+} // calloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+// A persistent block, grown by the arena code defined below, stays in its file;
+// a block of a separate heap, grown by the heap code, stays in its heap.
+static void* arena_grow (header_s* header_ptr, size_t size);
+static void* heap_grow  (header_s* header_ptr, size_t size);
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Update the given block at `ptr` to take on the given `size`.  Here, if `size`
+ * fits within the given block (whose size comes from its header, or, for a
+ * headerless small block, from its page), then the block is returned
+ * unchanged.  If it is the most recent block, and there is room after it, then
+ * it is grown in place.  If the block has its own mapping, then that mapping is
+ * resized, which the kernel can do without copying.  If it belongs to a
+ * file-backed arena or a separate heap, then it is grown within that arena or
+ * heap, or, if that is full, not at all.  Otherwise, if the `size`
+ * is an increase for the block, then a new and larger block is allocated, and
+ * the data from the old block is copied, the old block freed, and the new block
+ * returned.
+ *
+ * \param ptr  The block to be assigned a new size.
+ * \param size The new size that the block should assume.
+ * \return     A pointer to the resultant block, which may be `ptr` itself, or
+ *             may be a newly allocated block.
+ */
+static void* reallocate (void* ptr, size_t size) {
+
+  if (ptr == NULL) {
+    return allocate(size);
+  }
+  if (size == 0) {
+    deallocate(ptr);
+    return NULL;
+  }
+
+  if (!is_small(ptr)) {
+    header_check(header_of(ptr));
+  }
+  size_t old_size = block_size(ptr);
+  if (size <= old_size) {
+    return ptr;
+  }
+  if (size > MAX_REQUEST_SIZE) {
+    return NULL;
+  }
+
+  // Grow the most recent block in place, if there is room after it.
+  if (!is_small(ptr) &&
+      !(header_of(ptr)->flags & (HEADER_MAPPED | HEADER_ARENA | HEADER_GUARDED)) &&
+      grow_in_place(header_of(ptr), size)) {
+    count_block(size - old_size,
+		0,
+		ALIGN_UP(size + sizeof(header_s)) - ALIGN_UP(old_size + sizeof(header_s)));
+    return ptr;
+  }
+
+  // Keep a persistent block in its own file, rather than moving it out.
+  if (!is_small(ptr) && (header_of(ptr)->flags & HEADER_PERSISTENT)) {
+    return arena_grow(header_of(ptr), size);
+  }
+
+  // Likewise keep a block of a separate heap in that heap, to go with it.
+  if (!is_small(ptr) && (header_of(ptr)->flags & HEADER_HEAP)) {
+    return heap_grow(header_of(ptr), size);
+  }
+
+  // Move a mapped block's pages, rather than its contents.  Its header keeps
+  // its offset into the first page.
+  if (!is_small(ptr) && (header_of(ptr)->flags & HEADER_MAPPED)) {
+    header_s* old_header = header_of(ptr);
+    intptr_t  offset     = (intptr_t)old_header & (PAGE_SIZE - 1);
+    size_t    old_length = mapped_length(offset, old_size);
+    size_t    new_length = mapped_length(offset, size);
+    void*     map        = mremap(mapping_of(old_header),
+				  old_length,
+				  new_length,
+				  MREMAP_MAYMOVE);
+    if (map == MAP_FAILED) {
+      return NULL;
+    }
+    header_s* new_header = (header_s*)((intptr_t)map + offset);
+    new_header->size = size;
+    header_seal(new_header);
+    __atomic_add_fetch(&mapped_bytes, new_length - old_length, __ATOMIC_RELAXED);
+    count_block(size - old_size, 0, new_length - old_length);
+    return (void*)((intptr_t)new_header + sizeof(header_s));
+  }
+
+  void* new_ptr = allocate(size);
+  if (new_ptr != NULL) {
+    memcpy(new_ptr, ptr, old_size);
+    thread_stats.counts.realloc_copy_bytes += old_size;
+    deallocate(ptr);
+  }
+  return new_ptr;
+  
+} // reallocate ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Update the given block at `ptr` to take on the given `size`.
+ *
+ * \param ptr  The block to be assigned a new size.
+ * \param size The new size that the block should assume.
+ * \return     A pointer to the resultant block, which may be `ptr` itself, or
+ *             may be a newly allocated block.
+ */
+void* realloc (void* ptr, size_t size) {
+
+  local_stats()->realloc_calls += 1;
+  void* new_ptr = reallocate(ptr, size);
+  TRACE(TRACE_REALLOC, new_ptr, size, (uintptr_t)ptr);
+  return new_ptr;
+
+} // realloc()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Create a new arena, with its descriptor at the start of its region.
+ *
+ * \param reserve_bytes The address space to reserve for the arena.
+ * \param retain_bytes  How much of the arena to keep resident when released.
+ * \return              The new arena, if successful; `NULL` if unsuccessful.
+ */
+pb_arena_t* pb_arena_create (size_t reserve_bytes, size_t retain_bytes) {
+
+  init();
+
+  // Reserve whole huge pages, with room at least for the descriptor.
+  size_t size = ROUND_UP(reserve_bytes + sizeof(pb_arena_t) + ALIGNMENT, HUGE_PAGE_SIZE);
+  if (reserve_bytes > MAX_REQUEST_SIZE) {
+    return NULL;
+  }
+  intptr_t start = reserve(size);
+  if (start == 0) {
+    return NULL;
+  }
+
+  // Commit the first step, to hold the descriptor.
+  region_s region = { .start_addr  = start,
+		      .free_addr   = start,
+		      .commit_addr = start,
+		      .end_addr    = start + size,
+		      .dirty_addr  = start,
+		      .prev        = NULL,
+		      .node        = -1 };
+  if (!commit(&region, start + sizeof(pb_arena_t))) {
+    munmap((void*)start, size);
+    return NULL;
+  }
+
+  // As in a segment, start the free pointer so that the first block is aligned.
+  pb_arena_t* arena = (pb_arena_t*)start;
+  arena->region           = region;
+  arena->region.free_addr = (start + ALIGN_UP(sizeof(pb_arena_t))
+			     + ALIGNMENT - sizeof(header_s));
+  arena->base_addr        = arena->region.free_addr;
+  arena->high_addr        = arena->region.free_addr;
+  arena->retain_size      = retain_bytes;
+  arena->magic            = 0;
+  arena->root             = NULL;
+  arena->fd               = -1;
+  DEBUG("New arena: ", start, size);
+  return arena;
+
+} // pb_arena_create ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Open an arena backed by a file.  The whole file is mapped shared at once, so
+ * the arena's region is committed from the start, and its pages are those of
+ * the file.  The descriptor at the start of the region is the file's own
+ * header: a new file is given one (its magic number written last), and an
+ * existing file's is checked before it is mapped.  The file stays open, and
+ * locked, until the arena is destroyed.
+ *
+ * \param path          The path of the file.
+ * \param reserve_bytes For a new arena, the space to reserve for it.
+ * \param base          For a new arena, the address at which to map it, or
+ *                      `NULL`.
+ * \return              The arena, if successful; `NULL` if unsuccessful.
+ */
+pb_arena_t* pb_arena_open (const char* path, size_t reserve_bytes, void* base) {
+
+  init();
+
+  int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat info;
+  if (flock(fd, LOCK_EX | LOCK_NB) != 0 || fstat(fd, &info) != 0) {
+    close(fd);
+    return NULL;
+  }
+
+  // Size a new file, or find where an existing one's arena belongs.
+  bool     fresh = (info.st_size == 0);
+  intptr_t start = (intptr_t)base;
+  size_t   size;
+  if (fresh) {
+    size = ROUND_UP(reserve_bytes + sizeof(pb_arena_t) + ALIGNMENT, PAGE_SIZE);
+    if (reserve_bytes > MAX_REQUEST_SIZE || ftruncate(fd, size) != 0) {
+      close(fd);
+      return NULL;
+    }
+  } else {
+    pb_arena_t descriptor;
+    if (pread(fd, &descriptor, sizeof(descriptor), 0) != sizeof(descriptor) ||
+	descriptor.magic != ARENA_FILE_MAGIC ||
+	descriptor.region.end_addr - descriptor.region.start_addr != info.st_size) {
+      close(fd);
+      return NULL;
+    }
+    start = descriptor.region.start_addr;
+    size  = info.st_size;
+  }
+
+  // Map the file, refusing any address but the one asked for.
+  void* map = mmap((void*)start,
+		   size,
+		   PROT_READ | PROT_WRITE,
+		   MAP_SHARED | (start != 0 ? MAP_FIXED_NOREPLACE : 0),
+		   fd,
+		   0);
+  if (map == MAP_FAILED || (start != 0 && (intptr_t)map != start)) {
+    if (map != MAP_FAILED) {
+      munmap(map, size);
+    }
+    close(fd);
+    return NULL;
+  }
+  pb_arena_t* arena = (pb_arena_t*)map;
+  start = (intptr_t)map;
+
+  if (fresh) {
+    region_s region = { .start_addr  = start,
+			.free_addr   = (start + ALIGN_UP(sizeof(pb_arena_t))
+					+ ALIGNMENT - sizeof(header_s)),
+			.commit_addr = start + size,
+			.end_addr    = start + size,
+			.dirty_addr  = start,
+			.prev        = NULL,
+			.node        = -1 };
+    arena->region      = region;
+    arena->base_addr   = region.free_addr;
+    arena->high_addr   = region.free_addr;
+    arena->retain_size = 0;
+    arena->root        = NULL;
+    __atomic_store_n(&arena->magic, ARENA_FILE_MAGIC, __ATOMIC_RELEASE);
+  }
+  // Register the arena, so that its blocks can be grown within it.
+  arena->fd = fd;
+  spin_lock(&open_arenas_lock);
+  int slot = 0;
+  while (slot < OPEN_ARENAS_MAX && open_arenas[slot] != NULL) {
+    ++slot;
+  }
+  if (slot < OPEN_ARENAS_MAX) {
+    open_arenas[slot] = arena;
+  }
+  spin_unlock(&open_arenas_lock);
+  if (slot == OPEN_ARENAS_MAX) {
+    munmap(map, size);
+    close(fd);
+    return NULL;
+  }
+  DEBUG("Opened arena: ", start, size);
+  return arena;
+
+} // pb_arena_open ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Open the arena backed by the file named in the environment, if any, just
+ * once.
+ *
+ * \return The arena, if successful; `NULL` if unsuccessful.
+ */
+pb_arena_t* pb_heap_file () {
+
+  if (__atomic_load_n(&heap_file_tried, __ATOMIC_ACQUIRE)) {
+    return heap_file;
+  }
+
+  spin_lock(&heap_file_lock);
+  if (!heap_file_tried) {
+    const char* path = getenv(HEAP_FILE_ENV);
+    if (path != NULL) {
+      const char* size = getenv(HEAP_FILE_SIZE_ENV);
+      const char* base = getenv(HEAP_FILE_BASE_ENV);
+      heap_file = pb_arena_open(path,
+				(size != NULL ? strtoull(size, NULL, 0) : DEFAULT_HEAP_FILE_SIZE),
+				(void*)(intptr_t)(base != NULL ? strtoull(base, NULL, 0) : 0));
+    }
+    __atomic_store_n(&heap_file_tried, true, __ATOMIC_RELEASE);
+  }
+  spin_unlock(&heap_file_lock);
+  return heap_file;
+
+} // pb_heap_file ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Destroy an arena, unmapping its whole region.  A file-backed arena is first
+ * written back, as far as it has ever been used, and its file closed.
+ *
+ * \param arena The arena.
+ */
+void pb_arena_destroy (pb_arena_t* arena) {
+
+  intptr_t start = arena->region.start_addr;
+  int      fd    = arena->fd;
+  if (fd >= 0) {
+    msync((void*)start, ROUND_UP(arena->high_addr - start, PAGE_SIZE), MS_SYNC);
+    spin_lock(&open_arenas_lock);
+    for (int slot = 0; slot < OPEN_ARENAS_MAX; ++slot) {
+      if (open_arenas[slot] == arena) {
+	open_arenas[slot] = NULL;
+      }
+    }
+    spin_unlock(&open_arenas_lock);
+  }
+  munmap((void*)start, arena->region.end_addr - start);
+  if (fd >= 0) {
+    close(fd);
+  }
+
+} // pb_arena_destroy ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The root of an arena.
+ *
+ * \param arena The arena.
+ * \return      The root, or `NULL`.
+ */
+void* pb_arena_root (pb_arena_t* arena) {
+  return arena->root;
+} // pb_arena_root ()
+
+/**
+ * Set the root of an arena.
+ *
+ * \param arena The arena.
+ * \param root  The new root.
+ */
+void pb_arena_set_root (pb_arena_t* arena, void* root) {
+  arena->root = root;
+} // pb_arena_set_root ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a block from an arena by _pointer bumping_, just as `malloc()` does
+ * within a TLAB.
+ *
+ * \param arena The arena.
+ * \param size  The number of bytes to allocate.
+ * \return      A pointer to the allocated block, if successful; `NULL` if
+ *              unsuccessful.
+ */
+void* pb_arena_alloc (pb_arena_t* arena, size_t size) {
+
+  if (size == 0 || size > MAX_REQUEST_SIZE) {
+    return NULL;
+  }
+
+  // The arena has a single user, so its free pointer needs no atomic update.
+  size_t   total_size  = ALIGN_UP(size + sizeof(header_s));
+  intptr_t header_addr = arena->region.free_addr;
+  if (total_size > (size_t)(arena->region.end_addr - header_addr) ||
+      !commit(&arena->region, header_addr + total_size)) {
+    return NULL;
   }
-  void* new_ptr = malloc(size); //"Else", allocate new memory block of necessary size
-  if (new_ptr != NULL) { //when heap is full or when size==0...
-    memcpy(new_ptr, ptr, old_size); //... copy old_block at ptr (with old_size) into block at new_ptr
-    free(ptr); //...and free the old_block fat ptr
+  arena->region.free_addr = header_addr + total_size;
+  if (arena->region.free_addr > arena->high_addr) {
+    arena->high_addr = arena->region.free_addr;
   }
-  return new_ptr; //pointer to our new_block
-  
-} // realloc()
+
+  header_s* header_ptr = (header_s*)header_addr;
+  header_ptr->size  = size;
+  header_ptr->flags = HEADER_ARENA | (arena->fd >= 0 ? HEADER_PERSISTENT : 0);
+  header_seal(header_ptr);
+  return (void*)(header_addr + sizeof(header_s));
+
+} // pb_arena_alloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Grow a block of a file-backed arena within that arena, so that it stays in
+ * the file.  The arena's last block is extended in place; any other is copied
+ * to a new block of the arena, leaving the old one to be released with the
+ * rest.  Like any use of the arena, this must not race with another.
+ *
+ * \param header_ptr The block's header.
+ * \param size       The new size, larger than the old.
+ * \return           The grown block, if successful; `NULL` if the arena is
+ *                   full (leaving the block as it was).
+ */
+static void* arena_grow (header_s* header_ptr, size_t size) {
+
+  intptr_t    header_addr = (intptr_t)header_ptr;
+  pb_arena_t* arena       = NULL;
+  spin_lock(&open_arenas_lock);
+  for (int slot = 0; slot < OPEN_ARENAS_MAX && arena == NULL; ++slot) {
+    pb_arena_t* candidate = open_arenas[slot];
+    if (candidate != NULL &&
+	header_addr >= candidate->region.start_addr &&
+	header_addr <  candidate->region.end_addr) {
+      arena = candidate;
+    }
+  }
+  spin_unlock(&open_arenas_lock);
+  if (arena == NULL) {
+    ERROR("realloc(): block of an arena no longer open: ", header_addr + (intptr_t)sizeof(header_s));
+  }
+
+  size_t   old_size = header_ptr->size;
+  void*    ptr      = (void*)(header_addr + sizeof(header_s));
+  intptr_t old_end  = header_addr + ALIGN_UP(old_size + sizeof(header_s));
+  intptr_t new_end  = header_addr + ALIGN_UP(size + sizeof(header_s));
+  if (old_end == arena->region.free_addr) {
+    if (new_end > arena->region.end_addr || !commit(&arena->region, new_end)) {
+      return NULL;
+    }
+    arena->region.free_addr = new_end;
+    if (new_end > arena->high_addr) {
+      arena->high_addr = new_end;
+    }
+    header_ptr->size = size;
+    header_seal(header_ptr);
+    return ptr;
+  }
+
+  void* new_ptr = pb_arena_alloc(arena, size);
+  if (new_ptr != NULL) {
+    memcpy(new_ptr, ptr, old_size);
+    thread_stats.counts.realloc_copy_bytes += old_size;
+  }
+  return new_ptr;
+
+} // arena_grow ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Mark the current position of an arena.
+ *
+ * \param arena The arena.
+ * \return      The mark, which is just the arena's free pointer.
+ */
+pb_arena_mark_t pb_arena_mark (pb_arena_t* arena) {
+  return arena->region.free_addr;
+} // pb_arena_mark ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Release every block allocated from an arena since a mark was taken.  Moving
+ * the free pointer back is all that this takes; but if the arena had grown
+ * past its retention watermark, the pages beyond both it and the mark are
+ * returned to the kernel, too.
+ *
+ * \param arena The arena.
+ * \param mark  A mark taken from the same arena.
+ */
+void pb_arena_release (pb_arena_t* arena, pb_arena_mark_t mark) {
+
+  arena->region.free_addr = mark;
+
+  intptr_t keep = arena->region.start_addr + arena->retain_size;
+  if (keep < mark) {
+    keep = mark;
+  }
+  keep = ROUND_UP(keep, PAGE_SIZE);
+  if (keep < arena->high_addr) {
+    DEBUG("Purging arena: ", keep, arena->high_addr);
+    madvise((void*)keep,
+	    arena->high_addr - keep,
+	    (arena->fd >= 0 ? MADV_REMOVE : MADV_DONTNEED));
+    arena->high_addr = keep;
+  }
+
+} // pb_arena_release ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Release every block ever allocated from an arena.
+ *
+ * \param arena The arena.
+ */
+void pb_arena_reset (pb_arena_t* arena) {
+  pb_arena_release(arena, arena->base_addr);
+} // pb_arena_reset ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Create a new heap, with its descriptor at the start of its region.
+ *
+ * \param reserve_bytes The address space to reserve for the heap.
+ * \param flags         Any of the `PB_HEAP_` flags.
+ * \return              The new heap, if successful; `NULL` if unsuccessful.
+ */
+pb_heap_t* pb_heap_create (size_t reserve_bytes, int flags) {
+
+  init();
+  if (reserve_bytes > MAX_REQUEST_SIZE) {
+    return NULL;
+  }
+
+  // Reserve whole huge pages, with room at least for the descriptor.
+  size_t   size  = ROUND_UP(reserve_bytes + sizeof(pb_heap_t) + ALIGNMENT, HUGE_PAGE_SIZE);
+  intptr_t start = reserve(size);
+  if (start == 0) {
+    return NULL;
+  }
+  if (flags & PB_HEAP_HUGE_PAGES) {
+    madvise((void*)start, size, MADV_HUGEPAGE);
+  }
+  if ((flags & PB_HEAP_LOCAL_NODE) && numa_bound) {
+    numa_locate();
+  }
+
+  // Commit the first step, to hold the descriptor.
+  region_s region = { .start_addr  = start,
+		      .free_addr   = start,
+		      .commit_addr = start,
+		      .end_addr    = start + size,
+		      .dirty_addr  = start,
+		      .prev        = NULL,
+		      .node        = ((flags & PB_HEAP_LOCAL_NODE) && numa_bound ?
+				      thread_node : -1) };
+  if (!commit(&region, start + sizeof(pb_heap_t))) {
+    munmap((void*)start, size);
+    return NULL;
+  }
+
+  // As in a segment, start the free pointer so that the first block is aligned.
+  pb_heap_t* heap = (pb_heap_t*)start;
+  heap->region           = region;
+  heap->region.free_addr = (start + ALIGN_UP(sizeof(pb_heap_t))
+			    + ALIGNMENT - sizeof(header_s));
+  heap->base_addr        = heap->region.free_addr;
+  heap->id               = __atomic_add_fetch(&heap_count, 1, __ATOMIC_RELAXED);
+  heap->prev             = NULL;
+  spin_lock(&heap_list_lock);
+  heap->next = heap_list;
+  if (heap_list != NULL) {
+    heap_list->prev = heap;
+  }
+  heap_list = heap;
+  spin_unlock(&heap_list_lock);
+  DEBUG("New heap: ", start, size);
+  return heap;
+
+} // pb_heap_create ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a block from a separate heap by _pointer bumping_ within this
+ * thread's chunk of it, claiming a new chunk from the heap's region only when
+ * the block does not fit.  Blocks too large to share a chunk are claimed
+ * directly.
+ *
+ * \param heap The heap, which must not be `PB_HEAP_DEFAULT`.
+ * \param size The number of bytes to allocate.
+ * \return     A pointer to the allocated block, if successful; `NULL` if
+ *             unsuccessful.
+ */
+static void* heap_allocate (pb_heap_t* heap, size_t size) {
+
+  if (size == 0 || size > MAX_REQUEST_SIZE) {
+    return NULL;
+  }
+
+  size_t        total_size  = ALIGN_UP(size + sizeof(header_s));
+  heap_chunk_s* chunk       = &heap_chunks[heap->id % HEAP_CHUNK_SLOTS];
+  intptr_t      header_addr = chunk->free_addr;
+  if (chunk->id == heap->id && total_size <= (size_t)(chunk->end_addr - header_addr)) {
+    chunk->free_addr = header_addr + total_size;
+  } else if (total_size > HEAP_CHUNK_MAX_BLOCK) {
+    size_t got;
+    header_addr = claim(&heap->region, total_size, total_size, &got);
+  } else {
+    size_t got;
+    header_addr = claim(&heap->region, total_size, HEAP_CHUNK_SIZE, &got);
+    if (header_addr != 0) {
+      chunk->id        = heap->id;
+      chunk->free_addr = header_addr + total_size;
+      chunk->end_addr  = header_addr + got;
+    }
+  }
+  if (header_addr == 0) {
+    return NULL;
+  }
+
+  header_s* header_ptr = (header_s*)header_addr;
+  header_ptr->size  = size;
+  header_ptr->flags = HEADER_ARENA | HEADER_HEAP;
+  header_seal(header_ptr);
+  count_block(size, sizeof(header_s), total_size);
+  return (void*)(header_addr + sizeof(header_s));
+
+} // heap_allocate ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a block from a heap, counting the call as one to `malloc()`.
+ *
+ * \param heap The heap, or `PB_HEAP_DEFAULT`.
+ * \param size The number of bytes to allocate.
+ * \return     A pointer to the allocated block, if successful; `NULL` if
+ *             unsuccessful.
+ */
+void* pb_heap_malloc (pb_heap_t* heap, size_t size) {
+
+  if (heap == PB_HEAP_DEFAULT) {
+    return malloc(size);
+  }
+  local_stats()->malloc_calls += 1;
+  void* block_ptr = heap_allocate(heap, size);
+  TRACE(TRACE_MALLOC, block_ptr, size, 0);
+  return block_ptr;
+
+} // pb_heap_malloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Grow a block of a separate heap within that heap.  Finding the heap whose
+ * region holds the block, extend the block in place if it is the last in this
+ * thread's chunk, and the chunk has room; failing that, copy it to a new block
+ * of the same heap, leaving the old one to be released with the rest.
+ *
+ * \param header_ptr The block's header.
+ * \param size       The new size, larger than the old.
+ * \return           The grown block, if successful; `NULL` if the heap is
+ *                   full (leaving the block as it was).
+ */
+static void* heap_grow (header_s* header_ptr, size_t size) {
+
+  intptr_t header_addr = (intptr_t)header_ptr;
+  spin_lock(&heap_list_lock);
+  pb_heap_t* heap = heap_list;
+  while (heap != NULL &&
+	 (header_addr <  heap->region.start_addr ||
+	  header_addr >= heap->region.end_addr)) {
+    heap = heap->next;
+  }
+  spin_unlock(&heap_list_lock);
+  if (heap == NULL) {
+    ERROR("realloc(): block of a heap since destroyed: ", header_addr + (intptr_t)sizeof(header_s));
+  }
+
+  size_t        old_size = header_ptr->size;
+  void*         ptr      = (void*)(header_addr + sizeof(header_s));
+  intptr_t      old_end  = header_addr + ALIGN_UP(old_size + sizeof(header_s));
+  intptr_t      new_end  = header_addr + ALIGN_UP(size + sizeof(header_s));
+  heap_chunk_s* chunk    = &heap_chunks[heap->id % HEAP_CHUNK_SLOTS];
+  if (chunk->id == heap->id && old_end == chunk->free_addr && new_end <= chunk->end_addr) {
+    chunk->free_addr = new_end;
+    header_ptr->size = size;
+    header_seal(header_ptr);
+    count_block(size - old_size, 0, new_end - old_end);
+    return ptr;
+  }
+
+  void* new_ptr = heap_allocate(heap, size);
+  if (new_ptr != NULL) {
+    memcpy(new_ptr, ptr, old_size);
+    thread_stats.counts.realloc_copy_bytes += old_size;
+  }
+  return new_ptr;
+
+} // heap_grow ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Destroy a heap, taking it off the list of live heaps, unmapping its whole
+ * region, and uncounting the space claimed from it.
+ *
+ * \param heap The heap.
+ */
+void pb_heap_destroy (pb_heap_t* heap) {
+
+  spin_lock(&heap_list_lock);
+  if (heap->prev != NULL) {
+    heap->prev->next = heap->next;
+  } else {
+    heap_list = heap->next;
+  }
+  if (heap->next != NULL) {
+    heap->next->prev = heap->prev;
+  }
+  spin_unlock(&heap_list_lock);
+
+  region_s* region = &heap->region;
+  count_claimed(region, -(intptr_t)(region->free_addr - heap->base_addr));
+  heap_chunk_s* chunk = &heap_chunks[heap->id % HEAP_CHUNK_SLOTS];
+  if (chunk->id == heap->id) {
+    chunk->id = 0;
+  }
+  munmap((void*)region->start_addr, region->end_addr - region->start_addr);
+
+} // pb_heap_destroy ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Take a snapshot of the heap's statistics, summing those of every thread.
+ *
+ * \param stats Filled with the statistics.
+ */
+void pb_stats (pb_stats_t* stats) {
+
+  memset(stats, 0, sizeof(*stats));
+
+  spin_lock(&stats_lock);
+  stats_add(stats, &retired_stats);
+  for (thread_stats_s* current = stats_list; current != NULL; current = current->next) {
+    stats_add(stats, &current->counts);
+  }
+  spin_unlock(&stats_lock);
+
+  stats->padding_bytes   = (stats->bytes_consumed
+			    - stats->bytes_requested
+			    - stats->header_bytes);
+  stats->heap_bytes      = __atomic_load_n(&heap_bytes,      __ATOMIC_RELAXED);
+  stats->heap_high_water = __atomic_load_n(&heap_high_water, __ATOMIC_RELAXED);
+  stats->mapped_bytes    = __atomic_load_n(&mapped_bytes,    __ATOMIC_RELAXED);
+
+} // pb_stats ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Take a snapshot of the statistics of each NUMA node's partition of the heap.
+ *
+ * \param stats     Filled with the statistics of each node, in order.
+ * \param max_nodes The number of nodes for which `stats` has room.
+ * \return          The number of nodes into which the heap is partitioned, or
+ *                  `0` if it is not partitioned.
+ */
+int pb_node_stats (pb_node_stats_t* stats, int max_nodes) {
+
+  init();
+  if (!numa_bound) {
+    return 0;
+  }
+  for (int node = 0; node < numa_nodes && node < max_nodes; ++node) {
+    stats[node].heap_bytes = __atomic_load_n(&node_heap_bytes[node], __ATOMIC_RELAXED);
+    stats[node].refills    = __atomic_load_n(&node_refills[node],    __ATOMIC_RELAXED);
+  }
+  return numa_nodes;
+
+} // pb_node_stats ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Emit the heap's statistics as the process exits, if so requested.  Uses only
+ * the safe output functions, since the heap may be in any state by now.
+ */
+static void __attribute__ ((destructor)) stats_dump () {
+
+  if (getenv(STATS_ENV) == NULL) {
+    return;
+  }
+
+  pb_stats_t stats;
+  pb_stats(&stats);
+  INFO("pb_stats: malloc() calls:      ", stats.malloc_calls);
+  INFO("pb_stats: calloc() calls:      ", stats.calloc_calls);
+  INFO("pb_stats: realloc() calls:     ", stats.realloc_calls);
+  INFO("pb_stats: free() calls:        ", stats.free_calls);
+  INFO("pb_stats: memalign() calls:    ", stats.memalign_calls);
+  INFO("pb_stats: bytes requested:     ", stats.bytes_requested);
+  INFO("pb_stats: bytes consumed:      ", stats.bytes_consumed);
+  INFO("pb_stats: header bytes:        ", stats.header_bytes);
+  INFO("pb_stats: padding bytes:       ", stats.padding_bytes);
+  INFO("pb_stats: realloc copy bytes:  ", stats.realloc_copy_bytes);
+  INFO("pb_stats: heap bytes:          ", stats.heap_bytes);
+  INFO("pb_stats: heap high water:     ", stats.heap_high_water);
+  INFO("pb_stats: mapped bytes:        ", stats.mapped_bytes);
+
+  pb_node_stats_t nodes[NUMA_MAX_NODES];
+  int             count = pb_node_stats(nodes, NUMA_MAX_NODES);
+  for (int node = 0; node < count; ++node) {
+    INFO("pb_stats: node heap bytes:     ", (uint64_t)node, nodes[node].heap_bytes);
+    INFO("pb_stats: node refills:        ", (uint64_t)node, nodes[node].refills);
+  }
+
+} // stats_dump ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * A buffer of profile output, written (with no allocation) to a file.
+ */
+typedef struct prof_output {
+
+  int    fd;
+  size_t used;
+  bool   failed;
+  char   buffer[PROF_BUFFER_SIZE];
+
+} prof_output_s;
+
+/** Write out, and empty, a buffer of profile output. */
+static void prof_flush (prof_output_s* output) {
+
+  size_t written = 0;
+  while (written < output->used) {
+    ssize_t result = write(output->fd, output->buffer + written, output->used - written);
+    if (result <= 0) {
+      output->failed = true;
+      break;
+    }
+    written += result;
+  }
+  output->used = 0;
+
+} // prof_flush ()
+
+/** Append a string to a buffer of profile output. */
+static void prof_put (prof_output_s* output, const char* string) {
+
+  for (; *string != '\0'; ++string) {
+    if (output->used == PROF_BUFFER_SIZE) {
+      prof_flush(output);
+    }
+    output->buffer[output->used++] = *string;
+  }
+
+} // prof_put ()
+
+/** Append a number, in decimal or in (`0x`-prefixed) hexadecimal. */
+static void prof_put_number (prof_output_s* output, uint64_t value, bool hex) {
+
+  static const char digits[] = "0123456789abcdef";
+  unsigned int      base     = (hex ? 16 : 10);
+  char              text[24];
+  char*             current  = text + sizeof(text) - 1;
+  *current = '\0';
+  do {
+    *--current = digits[value % base];
+    value     /= base;
+  } while (value != 0);
+  if (hex) {
+    prof_put(output, "0x");
+  }
+  prof_put(output, current);
+
+} // prof_put_number ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Write the samples recorded so far as a heap profile: a header with the totals
+ * and the sampling rate, a line for each sample with its size and call stack,
+ * and the process's mappings, by which `pprof` symbolizes the stacks.
+ *
+ * \param path The file to write.
+ * \return     `0` if successful; `-1` if unsuccessful.
+ */
+int pb_prof_dump (const char* path) {
+
+  if (prof_rate == 0) {
+    return -1;
+  }
+
+  prof_output_s output = { .used = 0, .failed = false };
+  output.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (output.fd < 0) {
+    return -1;
+  }
+
+  size_t   used  = __atomic_load_n(&prof_used, __ATOMIC_RELAXED);
+  size_t   count = 0;
+  uint64_t bytes = 0;
+  used = (used < PROF_MAX_SAMPLES ? used : PROF_MAX_SAMPLES);
+  for (size_t i = 0; i < used; ++i) {
+    if (__atomic_load_n(&prof_samples[i].depth, __ATOMIC_ACQUIRE) > 0) {
+      count += 1;
+      bytes += prof_samples[i].size;
+    }
+  }
+
+  // Every sample is both allocated and (since nothing is re-used) in use.
+  for (int i = 0; i < 2; ++i) {
+    prof_put(&output, (i == 0 ? "heap profile: " : " ["));
+    prof_put_number(&output, count, false);
+    prof_put(&output, ": ");
+    prof_put_number(&output, bytes, false);
+  }
+  prof_put(&output, "] @ heap_v2/");
+  prof_put_number(&output, prof_rate, false);
+  prof_put(&output, "\n");
+
+  for (size_t i = 0; i < used; ++i) {
+    prof_sample_s* sample = &prof_samples[i];
+    int            depth  = __atomic_load_n(&sample->depth, __ATOMIC_ACQUIRE);
+    if (depth == 0) {
+      continue;
+    }
+    prof_put(&output, "1: ");
+    prof_put_number(&output, sample->size, false);
+    prof_put(&output, " [1: ");
+    prof_put_number(&output, sample->size, false);
+    prof_put(&output, "] @");
+    for (int frame = 0; frame < depth; ++frame) {
+      prof_put(&output, " ");
+      prof_put_number(&output, (uintptr_t)sample->stack[frame], true);
+    }
+    prof_put(&output, "\n");
+  }
+
+  // Copy the mappings verbatim.
+  prof_put(&output, "\nMAPPED_LIBRARIES:\n");
+  prof_flush(&output);
+  int maps = open("/proc/self/maps", O_RDONLY);
+  if (maps >= 0) {
+    ssize_t length;
+    while ((length = read(maps, output.buffer, PROF_BUFFER_SIZE)) > 0) {
+      output.used = length;
+      prof_flush(&output);
+    }
+    close(maps);
+  }
+
+  close(output.fd);
+  return (output.failed ? -1 : 0);
+
+} // pb_prof_dump ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Write the profile as the process exits, if profiling is on, to a file named
+ * by the prefix and the process ID.
+ */
+static void __attribute__ ((destructor)) prof_dump_at_exit () {
+
+  if (prof_rate == 0) {
+    return;
+  }
+
+  prof_output_s name = { .used = 0 };
+  prof_put(&name, prof_path);
+  prof_put(&name, ".");
+  prof_put_number(&name, getpid(), false);
+  prof_put(&name, ".heap");
+  name.buffer[name.used] = '\0';
+
+  if (pb_prof_dump(name.buffer) != 0) {
+    INFO("Could not write heap profile");
+  }
+
+} // prof_dump_at_exit ()
 // ==============================================================================
 
 
@@ -0,0 +1,165 @@
+// ==============================================================================
+/**
+ * pb-arena.h
+ *
+ * Arenas (regions) built on the pointer-bumping heap of `libpb`.  An arena is
+ * its own reserved region of address space, which is allocated from by
+ * _pointer bumping_, exactly as `malloc()` allocates from the heap.  Blocks are
+ * never freed individually; instead, all of the blocks allocated since a
+ * _mark_ are released at once, by moving the arena's free pointer back to it.
+ *
+ * An arena may instead be backed by a file, which it maps shared, so that what
+ * one process builds in it (say, a lookup index) outlasts the process: the next
+ * to open the file maps it back in, at the same address, and finds the index
+ * again through the arena's _root_, rather than rebuilding it.  Since blocks
+ * never move, and every pointer among them stays valid, nothing need be
+ * serialized.  The `PB_HEAP_FILE` environment variable names a file for such
+ * an arena, opened by `pb_heap_file()`.
+ *
+ * An arena may be used by only one thread at a time, and a file-backed arena
+ * by only one process at a time.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// Avoid multiple inclusion.
+
+#if !defined (_PB_ARENA_H)
+#define _PB_ARENA_H
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <stddef.h>
+#include <stdint.h>
+// ==============================================================================
+
+
+
+// ==============================================================================
+// TYPES
+
+/** An arena. */
+typedef struct pb_arena pb_arena_t;
+
+/** A position in an arena, to which it may later be released. */
+typedef intptr_t pb_arena_mark_t;
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Create a new arena.
+ *
+ * \param reserve_bytes The address space to reserve for the arena, which is
+ *                      committed only as it is used.
+ * \param retain_bytes  How much of the arena to keep resident when it is
+ *                      released; pages past this watermark are returned to the
+ *                      kernel.
+ * \return              The new arena, if successful; `NULL` if unsuccessful.
+ */
+pb_arena_t* pb_arena_create (size_t reserve_bytes, size_t retain_bytes);
+
+/**
+ * Open an arena backed by a file, creating the file if it is empty.  A file
+ * that holds an arena is mapped back at the address at which the arena was
+ * created, so that its blocks may hold pointers to one another; if that
+ * address is taken, the arena cannot be opened.
+ *
+ * \param path          The path of the file.
+ * \param reserve_bytes For a new arena, the space to reserve for it, which the
+ *                      file (being sparse) takes up only as it is used.
+ * \param base          For a new arena, the address at which to map it, or
+ *                      `NULL` for any address.
+ * \return              The arena, if successful; `NULL` if the file could not
+ *                      be created, does not hold an arena, cannot be mapped at
+ *                      its address, is open in another process, or if 64
+ *                      file-backed arenas are already open.
+ */
+pb_arena_t* pb_arena_open (const char* path, size_t reserve_bytes, void* base);
+
+/**
+ * The arena backed by the file that the `PB_HEAP_FILE` environment variable
+ * names, opened on the first call.  A new arena reserves `PB_HEAP_FILE_SIZE`
+ * bytes (1 GB, by default), at `PB_HEAP_FILE_BASE`, if that is set.
+ *
+ * \return The arena, if one is named and could be opened; `NULL` otherwise.
+ */
+pb_arena_t* pb_heap_file (void);
+
+/**
+ * Destroy an arena, unmapping it and every block allocated from it.  A
+ * file-backed arena's blocks are written back to its file, which keeps them.
+ *
+ * \param arena The arena.
+ */
+void pb_arena_destroy (pb_arena_t* arena);
+
+/**
+ * The root of an arena: the block by which a process finds what was built in a
+ * file-backed arena before it was opened.
+ *
+ * \param arena The arena.
+ * \return      The root, or `NULL` if none has been set.
+ */
+void* pb_arena_root (pb_arena_t* arena);
+
+/**
+ * Set the root of an arena.
+ *
+ * \param arena The arena.
+ * \param root  The new root, a block from the same arena, or `NULL`.
+ */
+void pb_arena_set_root (pb_arena_t* arena, void* root);
+
+/**
+ * Allocate a block from an arena.  The block is aligned as `malloc()` would
+ * align it, and carries the same header, so `realloc()` accepts it.  Passing it
+ * to `free()` does nothing.  Grown by `realloc()`, a block of a file-backed
+ * arena stays in its arena (in place, if it is the last block, or else copied
+ * to a new one), and `realloc()` returns `NULL` if the arena is full; a block
+ * of any other arena is copied into the heap.
+ *
+ * \param arena The arena.
+ * \param size  The number of bytes to allocate.
+ * \return      A pointer to the allocated block, if successful; `NULL` if
+ *              unsuccessful.
+ */
+void* pb_arena_alloc (pb_arena_t* arena, size_t size);
+
+/**
+ * Mark the current position of an arena.
+ *
+ * \param arena The arena.
+ * \return      The mark.
+ */
+pb_arena_mark_t pb_arena_mark (pb_arena_t* arena);
+
+/**
+ * Release every block allocated from an arena since a mark was taken, by
+ * moving the arena's free pointer back to that mark.
+ *
+ * \param arena The arena.
+ * \param mark  A mark taken from the same arena, and not since released past.
+ */
+void pb_arena_release (pb_arena_t* arena, pb_arena_mark_t mark);
+
+/**
+ * Release every block ever allocated from an arena.
+ *
+ * \param arena The arena.
+ */
+void pb_arena_reset (pb_arena_t* arena);
+// ==============================================================================
+
+
+
+// ==============================================================================
+#endif // _PB_ARENA_H
+// ==============================================================================
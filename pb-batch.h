@@ -0,0 +1,65 @@
+// ==============================================================================
+/**
+ * pb-batch.h
+ *
+ * Batch allocation, for programs that allocate many blocks of one size at
+ * once (a graph loader's nodes, say).  Each allocator exports these, and
+ * serves a batch as cheaply as its design allows: `libpb` bumps its free
+ * pointer once for each run of blocks that fits in the current TLAB or small
+ * page, and writes their headers in a tight loop; `libsf` moves whole runs of
+ * its thread cache at once; and `libbf` takes its lock just once per batch.
+ *
+ * Each block of a batch is an ordinary block, which may be passed to `free()`
+ * or `realloc()` on its own, and each is traced as its own `malloc()` or
+ * `free()`.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// Avoid multiple inclusion.
+
+#if !defined (_PB_BATCH_H)
+#define _PB_BATCH_H
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <stddef.h>
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `count` blocks of `size` bytes each, as `count` calls to `malloc()`
+ * would.
+ *
+ * \param size  The number of bytes in each block.
+ * \param count The number of blocks to allocate.
+ * \param out   Filled with the blocks, in order.
+ * \return      The number of blocks allocated, which is less than `count` only
+ *              if the heap is exhausted; the rest of `out` is left as it was.
+ */
+size_t pb_malloc_batch (size_t size, size_t count, void** out);
+
+/**
+ * Deallocate `count` blocks, as `count` calls to `free()` would.  Blocks are
+ * freed from last to first, so freeing a batch just as `pb_malloc_batch()`
+ * returned it gives it back whole, wherever the allocator can do so.
+ *
+ * \param ptrs  The blocks, any of which may be `NULL`.
+ * \param count The number of blocks.
+ */
+void pb_free_batch (void** ptrs, size_t count);
+// ==============================================================================
+
+
+
+// ==============================================================================
+#endif // _PB_BATCH_H
+// ==============================================================================
@@ -0,0 +1,90 @@
+// ==============================================================================
+/**
+ * pb-heap.h
+ *
+ * Separate heaps built on the pointer-bumping heap of `libpb`.  Each heap is
+ * its own reserved region of address space, from which any number of threads
+ * allocate by _pointer bumping_, each through a chunk of its own, just as
+ * `malloc()` allocates from the default heap through TLABs.  So a subsystem
+ * given a heap of its own keeps its blocks together, away from any other's,
+ * and all of them may be dropped at once by destroying the heap, which unmaps
+ * its whole region.
+ *
+ * Blocks from a heap may be passed to `realloc()`, which grows a block (or
+ * moves it) within the same heap, returning `NULL` if that heap is full, and
+ * to `free()`, which does nothing: they are released with the rest of their
+ * heap.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// Avoid multiple inclusion.
+
+#if !defined (_PB_HEAP_H)
+#define _PB_HEAP_H
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <stddef.h>
+// ==============================================================================
+
+
+
+// ==============================================================================
+// TYPES AND MACROS
+
+/** A heap.  `PB_HEAP_DEFAULT` names the default heap, from which `malloc()` allocates. */
+typedef struct pb_heap pb_heap_t;
+#define PB_HEAP_DEFAULT ((pb_heap_t*)NULL)
+
+/** A flag to back a heap with transparent huge pages. */
+#define PB_HEAP_HUGE_PAGES 0x1
+
+/** A flag to bind a heap to the NUMA node of the thread that creates it. */
+#define PB_HEAP_LOCAL_NODE 0x2
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Create a new heap.
+ *
+ * \param reserve_bytes The address space to reserve for the heap, which is
+ *                      committed only as it is used.
+ * \param flags         Any of the `PB_HEAP_` flags, or `0`.
+ * \return              The new heap, if successful; `NULL` if unsuccessful.
+ */
+pb_heap_t* pb_heap_create (size_t reserve_bytes, int flags);
+
+/**
+ * Allocate a block from a heap.  The block is aligned as `malloc()` would
+ * align it, and carries the same header.  Safe to call from any thread.
+ *
+ * \param heap The heap, or `PB_HEAP_DEFAULT`.
+ * \param size The number of bytes to allocate.
+ * \return     A pointer to the allocated block, if successful; `NULL` if
+ *             unsuccessful.
+ */
+void* pb_heap_malloc (pb_heap_t* heap, size_t size);
+
+/**
+ * Destroy a heap, unmapping it and every block allocated from it.  No thread
+ * may be allocating from it meanwhile.
+ *
+ * \param heap The heap, which must not be `PB_HEAP_DEFAULT`.
+ */
+void pb_heap_destroy (pb_heap_t* heap);
+// ==============================================================================
+
+
+
+// ==============================================================================
+#endif // _PB_HEAP_H
+// ==============================================================================
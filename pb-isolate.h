@@ -0,0 +1,54 @@
+// ==============================================================================
+/**
+ * pb-isolate.h
+ *
+ * Cache-line isolation for the pointer-bumping heap of `libpb`.  Each thread
+ * already allocates from its own TLAB and small pages, so blocks allocated by
+ * different threads never share a cache line.  But blocks allocated by one
+ * thread and then handed to others (say, by a thread that builds work items
+ * for a pool) are packed together, and threads writing neighboring blocks then
+ * contend for the same lines.  Under _isolation_, a block is instead placed at
+ * the start of a cache line, and padded out to a whole number of them, so that
+ * it shares its lines with no other block.
+ *
+ * Isolation applies to blocks of at most a given size.  That size is set for
+ * every thread by the `PB_ISOLATE` environment variable (a number of bytes, or
+ * `all`), and may be changed for any one thread with `pb_isolate()`.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// Avoid multiple inclusion.
+
+#if !defined (_PB_ISOLATE_H)
+#define _PB_ISOLATE_H
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <stddef.h>
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Set the largest block that the calling thread places on cache lines of its
+ * own.
+ *
+ * \param max_size The size, in bytes; `0` to turn isolation off, or `SIZE_MAX`
+ *                 to isolate every block.
+ */
+void pb_isolate (size_t max_size);
+// ==============================================================================
+
+
+
+// ==============================================================================
+#endif // _PB_ISOLATE_H
+// ==============================================================================
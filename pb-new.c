@@ -0,0 +1,189 @@
+// ==============================================================================
+/**
+ * pb-new.c
+ *
+ * Replacements for the C++ `operator new` and `operator delete`, so that each
+ * allocator (`libpb`, `libbf`, and `libsf`, all of which link this in) serves
+ * every allocation of a mixed C and C++ program, and sized and aligned deletes
+ * reach its `free_sized()` and `free_aligned_sized()`.
+ *
+ * These are written in C, under their mangled names, so that the library
+ * needs no C++ runtime of its own.  The one path that does need one, when an
+ * allocation fails, reaches the new-handler and `std::bad_alloc` of the
+ * program's `libstdc++` through weak references; only a C++ program, which
+ * has `libstdc++` loaded, ever calls these operators.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "free-sized.h"
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS AND FUNCTIONS
+
+/** The alignment of every block returned by `malloc()`. */
+#define ALIGNMENT 16
+// ==============================================================================
+
+
+
+// ==============================================================================
+// TYPES AND STRUCTURES
+
+/** A new-handler, as installed by `std::set_new_handler()`. */
+typedef void (*new_handler_f) (void);
+// ==============================================================================
+
+
+
+// ==============================================================================
+// GLOBALS
+
+/** `std::get_new_handler()` and `std::__throw_bad_alloc()`, if linked. */
+extern new_handler_f _ZSt15get_new_handlerv (void) __attribute__ ((weak));
+extern void          _ZSt17__throw_bad_allocv (void) __attribute__ ((weak, noreturn));
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a block for `operator new`.  Unlike `malloc()`, an empty request
+ * yields a unique block.  On failure, call the new-handler and try again, until
+ * there is no handler; then throw `std::bad_alloc`, or (for the `nothrow`
+ * forms, which may not throw, and so do not call the handler) return `NULL`.
+ *
+ * \param size      The number of bytes to allocate.
+ * \param alignment The alignment of the block.
+ * \param nothrow   Whether to return `NULL`, rather than throw, on failure.
+ * \return          The block.
+ */
+static void* cxx_allocate (size_t size, size_t alignment, bool nothrow) {
+
+  if (size == 0) {
+    size = 1;
+  }
+  while (true) {
+
+    void* ptr = (alignment <= ALIGNMENT ? malloc(size) : aligned_alloc(alignment, size));
+    if (ptr != NULL || nothrow) {
+      return ptr;
+    }
+
+    new_handler_f handler = (_ZSt15get_new_handlerv != NULL ? _ZSt15get_new_handlerv() : NULL);
+    if (handler == NULL) {
+      if (_ZSt17__throw_bad_allocv != NULL) {
+	_ZSt17__throw_bad_allocv();
+      }
+      abort();
+    }
+    handler();
+
+  }
+
+} // cxx_allocate ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+// OPERATOR NEW
+
+/** `operator new (std::size_t)` and `operator new[] (std::size_t)`. */
+void* _Znwm (size_t size) {
+  return cxx_allocate(size, ALIGNMENT, false);
+}
+void* _Znam (size_t size) {
+  return cxx_allocate(size, ALIGNMENT, false);
+}
+
+/** `operator new (std::size_t, const std::nothrow_t&)`, and its array form. */
+void* _ZnwmRKSt9nothrow_t (size_t size, const void* tag) {
+  return cxx_allocate(size, ALIGNMENT, true);
+}
+void* _ZnamRKSt9nothrow_t (size_t size, const void* tag) {
+  return cxx_allocate(size, ALIGNMENT, true);
+}
+
+/** `operator new (std::size_t, std::align_val_t)`, and its array form. */
+void* _ZnwmSt11align_val_t (size_t size, size_t alignment) {
+  return cxx_allocate(size, alignment, false);
+}
+void* _ZnamSt11align_val_t (size_t size, size_t alignment) {
+  return cxx_allocate(size, alignment, false);
+}
+
+/** `operator new (std::size_t, std::align_val_t, const std::nothrow_t&)`, and its array form. */
+void* _ZnwmSt11align_val_tRKSt9nothrow_t (size_t size, size_t alignment, const void* tag) {
+  return cxx_allocate(size, alignment, true);
+}
+void* _ZnamSt11align_val_tRKSt9nothrow_t (size_t size, size_t alignment, const void* tag) {
+  return cxx_allocate(size, alignment, true);
+}
+// ==============================================================================
+
+
+
+// ==============================================================================
+// OPERATOR DELETE
+
+/** `operator delete (void*)`, and its array form. */
+void _ZdlPv (void* ptr) {
+  free(ptr);
+}
+void _ZdaPv (void* ptr) {
+  free(ptr);
+}
+
+/** `operator delete (void*, std::size_t)`, and its array form. */
+void _ZdlPvm (void* ptr, size_t size) {
+  free_sized(ptr, size);
+}
+void _ZdaPvm (void* ptr, size_t size) {
+  free_sized(ptr, size);
+}
+
+/** `operator delete (void*, std::align_val_t)`, and its array form. */
+void _ZdlPvSt11align_val_t (void* ptr, size_t alignment) {
+  free(ptr);
+}
+void _ZdaPvSt11align_val_t (void* ptr, size_t alignment) {
+  free(ptr);
+}
+
+/** `operator delete (void*, std::size_t, std::align_val_t)`, and its array form. */
+void _ZdlPvmSt11align_val_t (void* ptr, size_t size, size_t alignment) {
+  free_aligned_sized(ptr, alignment, size);
+}
+void _ZdaPvmSt11align_val_t (void* ptr, size_t size, size_t alignment) {
+  free_aligned_sized(ptr, alignment, size);
+}
+
+/** `operator delete (void*, const std::nothrow_t&)`, and its array form. */
+void _ZdlPvRKSt9nothrow_t (void* ptr, const void* tag) {
+  free(ptr);
+}
+void _ZdaPvRKSt9nothrow_t (void* ptr, const void* tag) {
+  free(ptr);
+}
+
+/** `operator delete (void*, std::align_val_t, const std::nothrow_t&)`, and its array form. */
+void _ZdlPvSt11align_val_tRKSt9nothrow_t (void* ptr, size_t alignment, const void* tag) {
+  free(ptr);
+}
+void _ZdaPvSt11align_val_tRKSt9nothrow_t (void* ptr, size_t alignment, const void* tag) {
+  free(ptr);
+}
+// ==============================================================================
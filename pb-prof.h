@@ -0,0 +1,45 @@
+// ==============================================================================
+/**
+ * pb-prof.h
+ *
+ * The sampling heap profiler of `libpb`.  Setting the `PB_PROFILE` environment
+ * variable to a path prefix turns it on: every thread then records the call
+ * stack of roughly one allocation per `PB_PROFILE_RATE` bytes allocated
+ * (512 KB by default), with the intervals between samples drawn from a
+ * geometric distribution, so that every byte is equally likely to be sampled.
+ * When the process exits, the samples are written to `<prefix>.<pid>.heap`, in
+ * the legacy heap profile format that `pprof` reads.
+ *
+ * Since the heap never frees, every sampled allocation is reported as still in
+ * use.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// Avoid multiple inclusion.
+
+#if !defined (_PB_PROF_H)
+#define _PB_PROF_H
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Write the samples recorded so far as a heap profile.  Takes no locks and
+ * allocates nothing, so it may be called at any point.
+ *
+ * \param path The file to write; replaced if it exists.
+ * \return     `0` if successful; `-1` if profiling is off, or the file could
+ *             not be written.
+ */
+int pb_prof_dump (const char* path);
+// ==============================================================================
+
+
+
+// ==============================================================================
+#endif // _PB_PROF_H
+// ==============================================================================
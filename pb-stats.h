@@ -0,0 +1,112 @@
+// ==============================================================================
+/**
+ * pb-stats.h
+ *
+ * Statistics kept by the pointer-bumping heap of `libpb`.  Each thread counts
+ * its own calls and bytes privately; `pb_stats()` sums the counts of every
+ * thread, living or exited.  If the `PB_STATS` environment variable is set, the
+ * statistics are also emitted to `stderr` (in hexadecimal) when the process
+ * exits.  When the heap is partitioned by NUMA node, `pb_node_stats()` breaks
+ * its space down by node.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// Avoid multiple inclusion.
+
+#if !defined (_PB_STATS_H)
+#define _PB_STATS_H
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <stdint.h>
+// ==============================================================================
+
+
+
+// ==============================================================================
+// TYPES
+
+/** A snapshot of the heap's statistics. */
+typedef struct pb_stats {
+
+  /** The number of calls to each entry point. */
+  uint64_t malloc_calls;
+  uint64_t calloc_calls;
+  uint64_t realloc_calls;
+  uint64_t free_calls;
+
+  /** The number of calls to any of the aligned allocation entry points. */
+  uint64_t memalign_calls;
+
+  /** The bytes asked for by every allocation, including those within others. */
+  uint64_t bytes_requested;
+
+  /**
+   * The bytes of heap (or mapping) consumed by those allocations: the bytes
+   * requested, plus the header and alignment padding of each block.
+   */
+  uint64_t bytes_consumed;
+  uint64_t header_bytes;
+  uint64_t padding_bytes;
+
+  /** The bytes copied by `realloc()` when it could not grow a block in place. */
+  uint64_t realloc_copy_bytes;
+
+  /**
+   * The bytes claimed from the heap's segments and small page region (the sum
+   * of each region's `free_addr - start_addr`), now and at its highest.
+   */
+  uint64_t heap_bytes;
+  uint64_t heap_high_water;
+
+  /** The bytes held by blocks that have their own mappings. */
+  uint64_t mapped_bytes;
+
+} pb_stats_t;
+
+/** A snapshot of the statistics of one NUMA node's partition of the heap. */
+typedef struct pb_node_stats {
+
+  /** The bytes claimed from the node's segments and small pages. */
+  uint64_t heap_bytes;
+
+  /** The number of TLABs and small pages claimed by threads on the node. */
+  uint64_t refills;
+
+} pb_node_stats_t;
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Take a snapshot of the heap's statistics.  Other threads may be allocating
+ * while it is taken, so their most recent calls may or may not be counted.
+ *
+ * \param stats Filled with the statistics.
+ */
+void pb_stats (pb_stats_t* stats);
+
+/**
+ * Take a snapshot of the statistics of each NUMA node's partition of the heap.
+ *
+ * \param stats     Filled with the statistics of each node, in order.
+ * \param max_nodes The number of nodes for which `stats` has room.
+ * \return          The number of nodes into which the heap is partitioned, or
+ *                  `0` if it is not partitioned.
+ */
+int pb_node_stats (pb_node_stats_t* stats, int max_nodes);
+// ==============================================================================
+
+
+
+// ==============================================================================
+#endif // _PB_STATS_H
+// ==============================================================================
@@ -0,0 +1,526 @@
+// ==============================================================================
+/**
+ * replay.c
+ *
+ * Replay a trace recorded by the allocators' `TRACE()` (best kept with
+ * `PB_TRACE_MODE=record`, so that no records are lost), driving the allocator
+ * beneath the replayer through the same calls, with the same sizes, in the
+ * same order:
+ *
+ *     LD_PRELOAD=./libsf.so ./replay <trace file>
+ *
+ * The calls of every traced thread are replayed, in time stamp order, by a
+ * single thread, so every replay of a trace is the same.  Each block is
+ * written, a byte per page, when it is allocated, as the traced program would
+ * have.  The replayer reports the time taken by the calls, the peak of the
+ * anonymous memory resident (above what the replayer holds before it starts,
+ * and sampled every `RSS_INTERVAL` calls), the peak of the bytes live, and the
+ * fragmentation at the peak of resident memory: the share of it not holding
+ * live bytes.
+ *
+ * The replayer's own tables are mapped, rather than allocated, so that only the
+ * replayed calls reach the allocator.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS AND FUNCTIONS
+
+/** The number of calls between samples of the resident memory. */
+#define RSS_INTERVAL 4096
+
+/** The size of the pages that each new block is written across. */
+#define TOUCH_SIZE 4096
+
+/** One more than the largest operation code. */
+#define TRACE_OPS 6
+// ==============================================================================
+
+
+
+// ==============================================================================
+// TYPES AND STRUCTURES
+
+/** A block live in the replay, under the address that it had in the trace. */
+typedef struct entry {
+
+  /** The block's address in the trace; `0` if the entry is empty. */
+  uint64_t traced;
+
+  /** The block's address in the replay. */
+  void* block;
+
+  /** The size requested for the block. */
+  size_t size;
+
+  /** The number of the call that allocated it. */
+  uint64_t born;
+
+} entry_s;
+// ==============================================================================
+
+
+
+// ==============================================================================
+// GLOBALS
+
+/** The live blocks, in an open-addressed table of a power of two entries. */
+static entry_s* table      = NULL;
+static uint64_t table_mask = 0;
+
+/** The bytes live now, and at their peak. */
+static uint64_t live_bytes = 0;
+static uint64_t peak_live  = 0;
+
+/** The peak of the resident memory sampled, and the bytes live at that time. */
+static uint64_t peak_rss          = 0;
+static uint64_t live_at_peak_rss = 0;
+
+/** The calls replayed, of each operation. */
+static uint64_t calls[TRACE_OPS];
+
+/** The frees (and reallocations) of blocks that the trace never allocated. */
+static uint64_t unmatched = 0;
+
+/** The lifetimes, in calls, of the blocks freed, summed. */
+static uint64_t lifetimes = 0;
+static uint64_t deaths    = 0;
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Map zeroed memory, outside of the heap under test.
+ *
+ * \param length The number of bytes.
+ * \return       The memory; exits if it cannot be mapped.
+ */
+static void* map (size_t length) {
+
+  void* space = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (space == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  return space;
+
+} // map ()
+
+/**
+ * The current time.
+ *
+ * \return The monotonic time, in nanoseconds.
+ */
+static inline uint64_t now_ns () {
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+
+} // now_ns ()
+
+/**
+ * The anonymous memory resident in this process, read directly from the
+ * kernel, since `stdio` may allocate.
+ *
+ * \return The resident bytes, or `0` if they cannot be read.
+ */
+static uint64_t rss_anon () {
+
+  char    status[4096];
+  int     fd     = open("/proc/self/status", O_RDONLY);
+  ssize_t length = (fd < 0 ? -1 : read(fd, status, sizeof(status) - 1));
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (length <= 0) {
+    return 0;
+  }
+  status[length] = '\0';
+
+  char* line = strstr(status, "RssAnon:");
+  return (line == NULL ? 0 : strtoull(line + strlen("RssAnon:"), NULL, 10) * 1024);
+
+} // rss_anon ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/** The table entry at which to start looking for a traced address. */
+static inline uint64_t slot_of (uint64_t traced) {
+  return ((traced >> 4) * UINT64_C(0x9e3779b97f4a7c15)) >> 20 & table_mask;
+} // slot_of ()
+
+/**
+ * Find the live block that had a given address in the trace.
+ *
+ * \param traced The address.
+ * \return       Its entry, or `NULL` if there is none.
+ */
+static entry_s* table_find (uint64_t traced) {
+
+  for (uint64_t slot = slot_of(traced); table[slot].traced != 0; slot = (slot + 1) & table_mask) {
+    if (table[slot].traced == traced) {
+      return &table[slot];
+    }
+  }
+  return NULL;
+
+} // table_find ()
+
+/**
+ * Add a live block, replacing any with the same traced address.
+ *
+ * \param traced The block's address in the trace.
+ * \param block  The block's address in the replay.
+ * \param size   The size requested.
+ * \param call   The number of the call that allocated it.
+ */
+static void table_insert (uint64_t traced, void* block, size_t size, uint64_t call) {
+
+  uint64_t slot = slot_of(traced);
+  while (table[slot].traced != 0 && table[slot].traced != traced) {
+    slot = (slot + 1) & table_mask;
+  }
+  if (table[slot].traced == traced) {
+    live_bytes -= table[slot].size;
+  }
+  table[slot] = (entry_s){ .traced = traced, .block = block, .size = size, .born = call };
+
+  live_bytes += size;
+  peak_live = (live_bytes > peak_live ? live_bytes : peak_live);
+
+} // table_insert ()
+
+/**
+ * Remove a block, shifting back any later entries of its probe sequence, so
+ * that the table never fills with tombstones.
+ *
+ * \param entry The block's entry.
+ * \param call  The number of the call that freed it.
+ */
+static void table_remove (entry_s* entry, uint64_t call) {
+
+  live_bytes -= entry->size;
+  lifetimes  += call - entry->born;
+  deaths     += 1;
+
+  uint64_t hole = entry - table;
+  for (uint64_t slot = (hole + 1) & table_mask; table[slot].traced != 0; slot = (slot + 1) & table_mask) {
+
+    // An entry may fill the hole only if its probe sequence passes through the
+    // hole on the way to where it is.
+    uint64_t home = slot_of(table[slot].traced);
+    if (((slot - home) & table_mask) >= ((slot - hole) & table_mask)) {
+      table[hole] = table[slot];
+      hole        = slot;
+    }
+
+  }
+  table[hole].traced = 0;
+
+} // table_remove ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/** Write a byte to each page of a new block, as its program would. */
+static void touch (void* block, size_t size) {
+
+  char* bytes = (char*)block;
+  for (size_t offset = 0; offset < size; offset += TOUCH_SIZE) {
+    bytes[offset] = 1;
+  }
+  if (size > 0) {
+    bytes[size - 1] = 1;
+  }
+
+} // touch ()
+
+/**
+ * Replay one call.  Calls that failed in the trace are not replayed.
+ *
+ * \param record The call's record.
+ * \param call   The number of the call.
+ */
+static void replay_record (const trace_record_s* record, uint64_t call) {
+
+  void*    block = NULL;
+  entry_s* entry;
+  switch (record->op) {
+
+  case TRACE_MALLOC:
+    if (record->ptr != 0) {
+      block = malloc(record->size);
+      if (block == NULL) {
+	return;
+      }
+      touch(block, record->size);
+      table_insert(record->ptr, block, record->size, call);
+    }
+    break;
+
+  case TRACE_CALLOC:
+    if (record->ptr != 0) {
+      block = calloc(record->aux, record->aux == 0 ? 0 : record->size / record->aux);
+      if (block == NULL) {
+	return;
+      }
+      touch(block, record->size);
+      table_insert(record->ptr, block, record->size, call);
+    }
+    break;
+
+  case TRACE_MEMALIGN:
+    if (record->ptr != 0) {
+      size_t alignment = sizeof(void*);
+      while (alignment < record->aux) {
+	alignment <<= 1;
+      }
+      if (posix_memalign(&block, alignment, record->size) == 0) {
+	touch(block, record->size);
+	table_insert(record->ptr, block, record->size, call);
+      }
+    }
+    break;
+
+  case TRACE_REALLOC:
+    // A failed reallocation left its block alone.  Otherwise, the old block is
+    // gone, and the new one (if any) holds the new size.
+    if (record->ptr == 0 && record->size != 0) {
+      return;
+    }
+    entry = (record->aux == 0 ? NULL : table_find(record->aux));
+    if (record->aux != 0 && entry == NULL) {
+      unmatched += 1;
+      return;
+    }
+    size_t old_size = (entry == NULL ? 0 : entry->size);
+    block = realloc(entry == NULL ? NULL : entry->block, record->size);
+    if (entry != NULL) {
+      table_remove(entry, call);
+    }
+    if (block != NULL && record->ptr != 0) {
+      if (record->size > old_size) {
+	touch((char*)block + old_size, record->size - old_size);
+      }
+      table_insert(record->ptr, block, record->size, call);
+    }
+    break;
+
+  case TRACE_FREE:
+    if (record->ptr != 0) {
+      entry = table_find(record->ptr);
+      if (entry == NULL) {
+	unmatched += 1;
+	return;
+      }
+      free(entry->block);
+      table_remove(entry, call);
+    }
+    break;
+
+  default:
+    return;
+
+  }
+  calls[record->op] += 1;
+
+} // replay_record ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/** Order records by time stamp, and then by slot. */
+static int by_time (const void* a, const void* b) {
+
+  const trace_record_s* x = *(const trace_record_s* const*)a;
+  const trace_record_s* y = *(const trace_record_s* const*)b;
+  if (x->tsc != y->tsc) {
+    return (x->tsc < y->tsc ? -1 : 1);
+  }
+  return (x->seq < y->seq ? -1 : (x->seq > y->seq ? 1 : 0));
+
+} // by_time ()
+
+/**
+ * Sort records by time, with a merge sort whose scratch space is mapped.
+ * (`qsort()` would allocate its scratch space from the heap under test, and
+ * leave it resident there before the replay begins.)
+ *
+ * \param records The records.
+ * \param count   The number of records.
+ */
+static void sort_records (const trace_record_s** records, size_t count) {
+
+  const trace_record_s** from = records;
+  const trace_record_s** to   = map((count + 1) * sizeof(*records));
+  for (size_t width = 1; width < count; width *= 2) {
+    for (size_t start = 0; start < count; start += 2 * width) {
+      size_t middle = (start + width < count ? start + width : count);
+      size_t end    = (start + 2 * width < count ? start + 2 * width : count);
+      size_t left   = start;
+      size_t right  = middle;
+      for (size_t out = start; out < end; ++out) {
+	if (left < middle && (right == end || by_time(&from[left], &from[right]) <= 0)) {
+	  to[out] = from[left++];
+	} else {
+	  to[out] = from[right++];
+	}
+      }
+    }
+    const trace_record_s** swap = from;
+    from = to;
+    to   = swap;
+  }
+
+  if (from != records) {
+    memcpy(records, from, count * sizeof(*records));
+  }
+  munmap(from == records ? to : from, (count + 1) * sizeof(*records));
+
+} // sort_records ()
+
+/**
+ * Replay a trace file.
+ *
+ * \param argc The number of arguments.
+ * \param argv The arguments: the trace file.
+ * \return     `0` if successful; `1` if the file could not be replayed.
+ */
+int main (int argc, char** argv) {
+
+  if (argc != 2) {
+    fprintf(stderr, "USAGE: %s <trace file>\n", argv[0]);
+    return 1;
+  }
+  if (getenv("PB_TRACE") != NULL) {
+    fprintf(stderr, "%s: unset PB_TRACE, lest the replay trace over its own trace\n", argv[0]);
+    return 1;
+  }
+  const char* path = argv[1];
+
+  // Map the whole file, and check that it is a trace.
+  int         fd = open(path, O_RDONLY);
+  struct stat info;
+  if (fd < 0 || fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(trace_header_s)) {
+    fprintf(stderr, "%s: cannot read %s\n", argv[0], path);
+    return 1;
+  }
+  void* file = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (file == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+  const trace_header_s* header = (const trace_header_s*)file;
+  if (header->magic != TRACE_MAGIC ||
+      header->version != TRACE_VERSION ||
+      header->record_size != sizeof(trace_record_s) ||
+      (size_t)info.st_size < sizeof(trace_header_s) + header->capacity * sizeof(trace_record_s)) {
+    fprintf(stderr, "%s: %s is not a trace file\n", argv[0], path);
+    return 1;
+  }
+  const trace_record_s* ring = (const trace_record_s*)(header + 1);
+
+  // Gather the finished records, as `tracedump` does.  A trace that wrapped
+  // around, or dropped records, has lost calls, so replay it with a warning.
+  bool     record = (header->flags & TRACE_FLAG_RECORD) != 0;
+  uint64_t head   = header->head;
+  uint64_t first  = (head > header->capacity && !record ? head - header->capacity : 0);
+  if (record && head > header->capacity) {
+    head = header->capacity;
+  }
+  if (first > 0 || header->dropped > 0) {
+    fprintf(stderr, "%s: warning: %s is missing %" PRIu64 " records; "
+	    "record it with PB_TRACE_MODE=record and a larger PB_TRACE_RECORDS\n",
+	    argv[0], path, first + header->dropped);
+  }
+  const trace_record_s** records = map((head - first + 1) * sizeof(*records));
+  size_t count = 0;
+  for (uint64_t slot = first; slot < head; ++slot) {
+    const trace_record_s* current = &ring[slot & (header->capacity - 1)];
+    if (current->seq == slot + 1) {
+      records[count++] = current;
+    }
+  }
+  sort_records(records, count);
+
+  // Size the table for every record to be live at once, and touch it before
+  // taking the baseline, so that it counts against the replayer and not the
+  // allocator.
+  uint64_t capacity = 1024;
+  while (capacity < 2 * count) {
+    capacity <<= 1;
+  }
+  table      = map(capacity * sizeof(entry_s));
+  table_mask = capacity - 1;
+  memset(table, 0, capacity * sizeof(entry_s));
+  uint64_t baseline = rss_anon();
+
+  // Replay, timing only the calls.
+  uint64_t elapsed = 0;
+  for (size_t done = 0; done < count; ) {
+    size_t   end   = (count - done < RSS_INTERVAL ? count : done + RSS_INTERVAL);
+    uint64_t start = now_ns();
+    for (; done < end; ++done) {
+      replay_record(records[done], done);
+    }
+    elapsed += now_ns() - start;
+
+    uint64_t rss = rss_anon();
+    rss = (rss > baseline ? rss - baseline : 0);
+    if (rss > peak_rss) {
+      peak_rss         = rss;
+      live_at_peak_rss = live_bytes;
+    }
+  }
+
+  uint64_t replayed = 0;
+  for (int op = 1; op < TRACE_OPS; ++op) {
+    replayed += calls[op];
+  }
+  printf("calls:\t%" PRIu64 " (malloc %" PRIu64 ", calloc %" PRIu64 ", realloc %" PRIu64
+	 ", free %" PRIu64 ", memalign %" PRIu64 "; %" PRIu64 " unmatched)\n",
+	 replayed, calls[TRACE_MALLOC], calls[TRACE_CALLOC], calls[TRACE_REALLOC],
+	 calls[TRACE_FREE], calls[TRACE_MEMALIGN], unmatched);
+  printf("time:\t%.3f ms (%.1f ns/call)\n",
+	 elapsed / 1e6, replayed == 0 ? 0.0 : (double)elapsed / replayed);
+  printf("peak rss:\t%" PRIu64 " KB\n", peak_rss / 1024);
+  printf("peak live:\t%" PRIu64 " KB\n", peak_live / 1024);
+  printf("fragmentation:\t%.1f%% (%" PRIu64 " KB live at the peak of rss)\n",
+	 (peak_rss > live_at_peak_rss ?
+	  100.0 * (peak_rss - live_at_peak_rss) / peak_rss :
+	  0.0),
+	 live_at_peak_rss / 1024);
+  printf("mean lifetime:\t%.1f calls\n", deaths == 0 ? 0.0 : (double)lifetimes / deaths);
+  return 0;
+
+} // main ()
+// ==============================================================================
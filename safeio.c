@@ -135,6 +135,30 @@ safe_debug (const char* msg, int argc, ...) {
 
 
 
+// ==============================================================================
+/**
+ * Print an informational message.
+ *
+ * \param msg  The string to emit as a message to `stderr`.  Cannot be longer
+ *             than 256 characters.
+ * \param argc Count of the variadic arguments.
+ * \param ...  The variadic arguments (0 or more) of integers to be appended to
+ *             the output.
+ */
+void
+safe_info (const char* msg, int argc, ...) {
+
+  // Emit the informational message.
+  va_list argp;
+  va_start(argp, argc);
+  emit("INFO: ", msg, argc, argp);
+  va_end(argp);
+  
+} // safe_info ()
+// ==============================================================================
+
+
+
 // ==============================================================================
 /**
  * Print an error message and abort the process.  **Does not return**
@@ -22,6 +22,9 @@
 
 #define NUMARGS(...)  (sizeof((int[]){__VA_ARGS__})/sizeof(int))
 
+/** Emit an informational message. */
+#define INFO(msg,...) safe_info(msg, NUMARGS(__VA_ARGS__), ##__VA_ARGS__)
+
 /** Emit an error message. */
 #define ERROR(msg,...) safe_error(msg, NUMARGS(__VA_ARGS__), ##__VA_ARGS__)
 
@@ -47,6 +50,17 @@
  */
 void safe_debug (const char* msg, int argc, ...);
 
+/**
+ * Print an informational message.
+ *
+ * \param msg  The string to emit as a message to `stderr`.  Cannot be longer
+ *             than 256 characters.
+ * \param argc Count of the variadic arguments.
+ * \param ...  The variadic arguments (0 or more) of integers to be appended to
+ *             the output.
+ */
+void safe_info (const char* msg, int argc, ...);
+
 /**
  * Print an error message and abort the process.  **Does not return**
  *
@@ -0,0 +1,1626 @@
+// ==============================================================================
+/**
+ * sf-alloc.c
+ *
+ * A _segregated-fits_ heap allocator.  This allocator *does re-use* freed
+ * blocks.  Every small request is rounded up to one of a fixed set of _size
+ * classes_, and each class keeps its own free list, so that both allocation and
+ * deallocation are constant-time pops and pushes, with no searching.  When a
+ * class's free list is empty, a new block of that class is carved from the heap
+ * via _pointer bumping_.  Requests too large for any class are given their own
+ * `mmap()` mapping, which is unmapped when freed.
+ *
+ * Each thread caches freed blocks of each class, so that a `malloc()` and
+ * `free()` pair takes no lock and no atomic operation.  A thread's cache is
+ * refilled from (and, when it grows too full, flushed to) a central free list
+ * for the class, a whole batch of blocks at a time.
+ *
+ * Every small block records the thread heap that allocated it.  A block freed
+ * by any other thread is pushed, with a single compare-and-swap, onto its
+ * owner's _remote-free queue_, and the owner takes the whole queue back into
+ * its caches with a single exchange the next time it is on a slow path.  So a
+ * cross-thread `free()` neither takes a lock nor touches the freeing thread's
+ * own caches, and blocks return to the thread that is likeliest to reuse them.
+ *
+ * Pages that stay free are eventually returned to the kernel: every _decay
+ * interval_, a background thread sweeps the central lists, and the pages of
+ * any span of neighboring blocks that has sat on its list for a whole interval
+ * are released with `madvise()`.  Such a span stays on the list as a single
+ * _purged run_, from which blocks are carved again, much as from the heap.
+ *
+ * The heap survives `fork()`: handlers registered as the library loads take
+ * every lock before the fork, and in the child abandon the heaps of the
+ * threads that did not survive it, so that their caches and remote-free queues
+ * are adopted rather than lost.  No entry point is async-signal-safe, since
+ * each may take a lock or update this thread's caches.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "free-sized.h"
+#include "pb-batch.h"
+#include "safeio.h"
+#include "trace.h"
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS AND FUNCTIONS
+
+/** The system's page size. */
+#define PAGE_SIZE sysconf(_SC_PAGESIZE)
+
+/**
+ * Macros to easily calculate the number of bytes for larger scales (e.g., kilo,
+ * mega, gigabytes).
+ */
+#define KB(size)  ((size_t)size * 1024)
+#define MB(size)  (KB(size) * 1024)
+#define GB(size)  (MB(size) * 1024)
+
+/** The virtual address space reserved for the heap of small blocks. */
+#define HEAP_SIZE GB(2)
+
+/** The alignment of every block returned by `malloc()`. */
+#define ALIGNMENT 16
+
+/** Round `value` up to the next multiple of `ALIGNMENT`. */
+#define ALIGN_UP(value) (((value) + (ALIGNMENT - 1)) & ~((size_t)ALIGNMENT - 1))
+
+/** Whether `value` is a power of two. */
+#define IS_POWER_OF_TWO(value) ((value) != 0 && ((value) & ((value) - 1)) == 0)
+
+/**
+ * The size classes.  Classes are spaced `ALIGNMENT` bytes apart up to
+ * `QUANTUM_MAX_SIZE`, and then four to each doubling (as in jemalloc), up to
+ * `MAX_CLASS_SIZE`.  Sizes are of whole blocks, including the header.
+ */
+#define QUANTUM_CLASSES  8
+#define QUANTUM_MAX_SIZE (QUANTUM_CLASSES * ALIGNMENT)
+#define CLASSES_PER_DOUBLING_LOG 2
+#define CLASSES_PER_DOUBLING     (1 << CLASSES_PER_DOUBLING_LOG)
+#define MAX_CLASS_SIZE   KB(32)
+#define NUM_CLASSES      40
+
+/**
+ * Blocks move between a thread's cache and a central list in batches of up to
+ * `CACHE_BATCH_MAX` blocks, or `CACHE_BATCH_BYTES` bytes, whichever is fewer
+ * (but at least `CACHE_BATCH_MIN` blocks).  A thread caches up to two batches
+ * of each class.
+ */
+#define CACHE_BATCH_MAX   32
+#define CACHE_BATCH_MIN   2
+#define CACHE_BATCH_BYTES KB(64)
+
+/**
+ * The bits of a free block's size word that record its decay on a central
+ * list: _aged_ once it has been seen there by one sweep, and _run_ for the
+ * first block of a purged run.  Class sizes are multiples of `ALIGNMENT`,
+ * leaving the low bits free.
+ */
+#define AGED_BIT   ((size_t)1)
+#define RUN_BIT    ((size_t)2)
+
+/**
+ * The decay interval, in milliseconds, between sweeps of the central lists.  A
+ * page is purged one to two intervals after it reaches a central list.  Set by
+ * the `PB_DIRTY_DECAY_MS` environment variable; `0` disables purging.
+ */
+#define DECAY_ENV        "PB_DIRTY_DECAY_MS"
+#define DEFAULT_DECAY_MS 10000
+
+/**
+ * Thread-local storage for each thread's cache.  The _initial-exec_ model keeps
+ * accesses to a single instruction, and ensures that touching it never calls
+ * back into `malloc()`.
+ */
+#define THREAD_LOCAL __thread __attribute__ ((tls_model ("initial-exec")))
+// ==============================================================================
+
+
+
+// ==============================================================================
+// TYPES AND STRUCTURES
+
+/** A header for each block's metadata. */
+typedef struct header {
+
+  /**
+   * The size of the whole block, in bytes.  For a small block, this is its
+   * class's size; for a large block, it is the length of its mapping from
+   * `ALIGNMENT` bytes before its usable space.  (Only an aligned block starts
+   * past the beginning of its mapping's first page.)
+   */
+  size_t size;
+
+  /** The thread heap that allocated a small block; `NULL` for a large block. */
+  struct thread_heap* owner;
+
+} header_s;
+
+/** A free block, linked through its usable space. */
+typedef struct free_block {
+
+  /** The next free block of the same class. */
+  struct free_block* next;
+
+  /**
+   * For the first block of a purged run, the number of blocks in the run: a
+   * span of neighboring free blocks, whose pages past this link have been
+   * returned to the kernel, and whose other headers are written again only as
+   * blocks are carved from it.
+   */
+  size_t run;
+
+} free_block_s;
+
+/** A thread's cache of the free blocks of one class. */
+typedef struct cache_bin {
+
+  /** The most recently freed block. */
+  free_block_s* head;
+
+  /** The number of blocks cached. */
+  size_t count;
+
+  /**
+   * The number of blocks beyond which the cache is flushed; zero until the
+   * cache is first refilled or flushed.
+   */
+  size_t limit;
+
+} cache_bin_s;
+
+/** The central free list of one class, shared by every thread. */
+typedef struct central_list {
+
+  /** Held while moving blocks onto or off of the list. */
+  pthread_mutex_t lock;
+
+  /** The first free block. */
+  free_block_s* head;
+
+} central_list_s;
+
+/**
+ * A thread's heap: its caches, and the queue of blocks freed to it by other
+ * threads.  Thread heaps are carved from the heap itself, and are never
+ * released; when its thread exits, a thread heap is abandoned, to be adopted
+ * by the next thread that needs one.
+ */
+typedef struct thread_heap {
+
+  /** The cache of each size class. */
+  cache_bin_s bins[NUM_CLASSES];
+
+  /**
+   * The blocks freed by other threads, most recent first.  Any thread may push
+   * onto it; only the owner takes from it, and then takes the whole queue.
+   */
+  free_block_s* remote;
+
+  /** The next abandoned thread heap. */
+  struct thread_heap* next_abandoned;
+
+  /** The next of every thread heap ever carved; guarded by the heap lock. */
+  struct thread_heap* next_heap;
+
+  /** Whether a thread is using the heap; guarded by the heap lock. */
+  bool attached;
+
+} thread_heap_s;
+// ==============================================================================
+
+
+
+// ==============================================================================
+// GLOBALS
+
+/** The address of the next available byte in the heap region. */
+static intptr_t free_addr  = 0;
+
+/** The beginning of the heap. */
+static intptr_t start_addr = 0;
+
+/** The end of the heap. */
+static intptr_t end_addr   = 0;
+
+/** The central free list of each size class. */
+static central_list_s central_lists[NUM_CLASSES] = {
+  [0 ... NUM_CLASSES - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER, .head = NULL }
+};
+
+/** This thread's heap; `NULL` until its first trip down a slow path. */
+static THREAD_LOCAL thread_heap_s* local_heap = NULL;
+
+/** The heaps of exited threads, awaiting adoption; guarded by the heap lock. */
+static thread_heap_s* abandoned_heaps = NULL;
+
+/** Every thread heap ever carved; guarded by the heap lock. */
+static thread_heap_s* all_heaps = NULL;
+
+/** The key whose destructor abandons an exiting thread's heap. */
+static pthread_key_t cache_key;
+
+/** Serializes carving new blocks (and thread heaps) from the heap. */
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** The decay interval, in milliseconds. */
+static long decay_ms = DEFAULT_DECAY_MS;
+// ==============================================================================
+
+
+
+// ==============================================================================
+// SIZE CLASS AND BLOCK FUNCTIONS
+
+/**
+ * The size class that holds a whole block of `size` bytes, which must be no
+ * larger than `MAX_CLASS_SIZE`.
+ */
+static inline int size_class (size_t size) {
+
+  if (size <= QUANTUM_MAX_SIZE) {
+    return (size - 1) / ALIGNMENT;
+  }
+
+  // Find the power of two just below the size, then which quarter of the way
+  // to the next power of two the size falls in.
+  int log2_size = 63 - __builtin_clzl(size - 1);
+  int quarter   = ((size - 1) >> (log2_size - CLASSES_PER_DOUBLING_LOG))
+                  & (CLASSES_PER_DOUBLING - 1);
+  return (QUANTUM_CLASSES
+	  + (log2_size - __builtin_ctzl(QUANTUM_MAX_SIZE)) * CLASSES_PER_DOUBLING
+	  + quarter);
+
+} // size_class ()
+
+/** The whole block size of a size class. */
+static inline size_t class_size (int class) {
+
+  if (class < QUANTUM_CLASSES) {
+    return (class + 1) * ALIGNMENT;
+  }
+  int    doubling = (class - QUANTUM_CLASSES) / CLASSES_PER_DOUBLING;
+  int    step     = (class - QUANTUM_CLASSES) % CLASSES_PER_DOUBLING;
+  size_t base     = QUANTUM_MAX_SIZE << doubling;
+  return base + (step + 1) * (base / CLASSES_PER_DOUBLING);
+
+} // class_size ()
+
+/** The usable space of a block. */
+static inline void* block_of (header_s* header_ptr) {
+  return (void*)((intptr_t)header_ptr + sizeof(header_s));
+}
+
+/** The header of the block whose usable space begins at `ptr`. */
+static inline header_s* header_of (void* ptr) {
+  return (header_s*)((intptr_t)ptr - sizeof(header_s));
+}
+
+/** The number of blocks moved at once between a cache and a central list. */
+static inline size_t batch_size (int class) {
+
+  size_t batch = CACHE_BATCH_BYTES / class_size(class);
+  return (batch > CACHE_BATCH_MAX ? CACHE_BATCH_MAX :
+	  (batch < CACHE_BATCH_MIN ? CACHE_BATCH_MIN : batch));
+
+} // batch_size ()
+
+/** The number of usable bytes in a block. */
+static inline size_t usable_size (header_s* header_ptr) {
+
+  // Large blocks also skip the padding that aligns them within their mapping.
+  size_t size = header_ptr->size;
+  return size - (size > MAX_CLASS_SIZE ? ALIGNMENT : sizeof(header_s));
+
+} // usable_size ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+// THREAD CACHE FUNCTIONS
+
+/**
+ * Move a chain of free blocks onto the front of a central list.
+ *
+ * \param class The size class.
+ * \param head  The first block of the chain.
+ * \param tail  The last block of the chain.
+ */
+static void central_push (int class, free_block_s* head, free_block_s* tail) {
+
+  central_list_s* central = &central_lists[class];
+  pthread_mutex_lock(&central->lock);
+  tail->next    = central->head;
+  central->head = head;
+  pthread_mutex_unlock(&central->lock);
+
+} // central_push ()
+
+/**
+ * Set up a thread heap's cache of a class, the first time that it is used:
+ * set its limit.
+ *
+ * \param heap  The thread heap.
+ * \param class The size class.
+ */
+static void cache_setup (thread_heap_s* heap, int class) {
+  heap->bins[class].limit = 2 * batch_size(class);
+} // cache_setup ()
+
+/**
+ * Trim a thread heap's cache of a class, if it has grown past its limit.  Keep
+ * the most recently freed batch, which is likeliest to still be in the
+ * processor's cache, and flush the rest to the central list.
+ *
+ * \param heap  The thread heap.
+ * \param class The size class.
+ */
+static void cache_trim (thread_heap_s* heap, int class) {
+
+  cache_bin_s* bin = &heap->bins[class];
+  if (bin->limit == 0) {
+    cache_setup(heap, class);
+  }
+  if (bin->count <= bin->limit) {
+    return;
+  }
+
+  size_t        keep = batch_size(class);
+  free_block_s* last = bin->head;
+  for (size_t i = 1; i < keep; ++i) {
+    last = last->next;
+  }
+  free_block_s* head = last->next;
+  free_block_s* tail = head;
+  while (tail->next != NULL) {
+    tail = tail->next;
+  }
+  last->next = NULL;
+  bin->count = keep;
+  central_push(class, head, tail);
+
+} // cache_trim ()
+
+/**
+ * Free a block to the thread heap that owns it, from some other thread: push
+ * it onto the owner's remote-free queue.
+ *
+ * \param owner The owning thread heap.
+ * \param block The block.
+ */
+static void remote_free (thread_heap_s* owner, free_block_s* block) {
+
+  free_block_s* head = __atomic_load_n(&owner->remote, __ATOMIC_RELAXED);
+  do {
+    block->next = head;
+  } while (!__atomic_compare_exchange_n(&owner->remote,
+					&head,
+					block,
+					true,
+					__ATOMIC_RELEASE,
+					__ATOMIC_RELAXED));
+
+} // remote_free ()
+
+/**
+ * Take every block on a thread heap's remote-free queue into the heap's caches,
+ * trimming any cache that grows past its limit.  Called only by the owner.
+ *
+ * \param heap The thread heap.
+ */
+static void remote_drain (thread_heap_s* heap) {
+
+  if (__atomic_load_n(&heap->remote, __ATOMIC_RELAXED) == NULL) {
+    return;
+  }
+
+  free_block_s* block = __atomic_exchange_n(&heap->remote, NULL, __ATOMIC_ACQUIRE);
+  while (block != NULL) {
+    free_block_s* next  = block->next;
+    int           class = size_class(header_of(block)->size);
+    cache_bin_s*  bin   = &heap->bins[class];
+    block->next = bin->head;
+    bin->head   = block;
+    bin->count += 1;
+    if (bin->count > bin->limit) {
+      cache_trim(heap, class);
+    }
+    block = next;
+  }
+
+} // remote_drain ()
+
+/**
+ * Abandon an exiting thread's heap: flush every cached block to the central
+ * lists, and leave the heap to be adopted by a later thread.  Called as the
+ * destructor of the cache key.  Blocks freed to the heap after this wait on
+ * its remote-free queue for its adopter.
+ *
+ * \param arg The thread's heap.
+ */
+static void heap_abandon (void* arg) {
+
+  thread_heap_s* heap = (thread_heap_s*)arg;
+  remote_drain(heap);
+  for (int class = 0; class < NUM_CLASSES; ++class) {
+    cache_bin_s* bin = &heap->bins[class];
+    if (bin->head != NULL) {
+      free_block_s* tail = bin->head;
+      while (tail->next != NULL) {
+	tail = tail->next;
+      }
+      central_push(class, bin->head, tail);
+    }
+    bin->head  = NULL;
+    bin->count = 0;
+  }
+  local_heap = NULL;
+
+  pthread_mutex_lock(&heap_lock);
+  heap->attached       = false;
+  heap->next_abandoned = abandoned_heaps;
+  abandoned_heaps      = heap;
+  pthread_mutex_unlock(&heap_lock);
+
+} // heap_abandon ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The initialization method.  If this is the first use of the heap, initialize
+ * it.  Must be called with the heap lock held.
+ */
+
+static void init () {
+
+  // Only do anything if there is no heap region (i.e., first time called).
+  if (start_addr == 0) {
+
+    DEBUG("Trying to initialize");
+
+    // Allocate virtual address space in which the heap will reside. Make it
+    // un-shared and not backed by any file (_anonymous_ space).  A failure to
+    // map this space is fatal.
+    void* heap = mmap(NULL,
+		      HEAP_SIZE,
+		      PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS,
+		      -1,
+		      0);
+    if (heap == MAP_FAILED) {
+      ERROR("Could not mmap() heap region");
+    }
+
+    // Hold onto the boundaries of the heap as a whole.  Start the first block
+    // just far enough in that its usable space is aligned.
+    start_addr = (intptr_t)heap;
+    end_addr   = start_addr + HEAP_SIZE;
+    free_addr  = start_addr + ALIGNMENT - sizeof(header_s);
+
+    // Arrange for each thread's heap to be abandoned when the thread exits.
+    pthread_key_create(&cache_key, heap_abandon);
+
+    // Choose how quickly free pages decay.
+    const char* decay = getenv(DECAY_ENV);
+    if (decay != NULL) {
+      decay_ms = strtol(decay, NULL, 10);
+    }
+
+    // DEBUG: Emit a message to indicate that this allocator is being called.
+    DEBUG("sf-alloc initialized");
+
+  }
+
+} // init ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Give this thread a heap: adopt an abandoned one, if there is one, or else
+ * carve a new one from the heap.  Arrange for it to be abandoned in turn when
+ * the thread exits.
+ *
+ * \return The thread's heap, if successful; `NULL` if the heap is exhausted.
+ */
+static thread_heap_s* heap_attach () {
+
+  size_t length = (sizeof(thread_heap_s) + 63) & ~(size_t)63;
+
+  pthread_mutex_lock(&heap_lock);
+  init();
+  thread_heap_s* heap = abandoned_heaps;
+  if (heap != NULL) {
+    abandoned_heaps = heap->next_abandoned;
+  } else if (end_addr - free_addr >= (intptr_t)length) {
+    heap            = (thread_heap_s*)free_addr;
+    free_addr      += length;
+    heap->next_heap = all_heaps;
+    all_heaps       = heap;
+  }
+  if (heap != NULL) {
+    heap->attached = true;
+  }
+  pthread_mutex_unlock(&heap_lock);
+  if (heap == NULL) {
+    return NULL;
+  }
+
+  heap->next_abandoned = NULL;
+  local_heap           = heap;
+  pthread_setspecific(cache_key, heap);
+  remote_drain(heap);
+  return heap;
+
+} // heap_attach ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+// DECAY FUNCTIONS
+
+/**
+ * Return the whole pages within a span to the kernel.  `MADV_FREE` lets the
+ * kernel reclaim them lazily, only under memory pressure, and keeps them cheap
+ * to re-use; where it is unsupported, fall back to `MADV_DONTNEED`.
+ *
+ * \param start The beginning of the span.
+ * \param end   The end of the span.
+ * \return      Whether the span held any whole page.
+ */
+static bool purge_span (intptr_t start, intptr_t end) {
+
+  intptr_t page_mask  = PAGE_SIZE - 1;
+  intptr_t page_start = (start + page_mask) & ~page_mask;
+  intptr_t page_end   = end & ~page_mask;
+  if (page_end <= page_start) {
+    return false;
+  }
+
+  DEBUG("Purging: ", page_start, page_end);
+  if (madvise((void*)page_start, page_end - page_start, MADV_FREE) != 0) {
+    madvise((void*)page_start, page_end - page_start, MADV_DONTNEED);
+  }
+  return true;
+
+} // purge_span ()
+
+/**
+ * Sort a chain of free blocks by address.
+ *
+ * \param head The first block of the chain.
+ * \return     The first block of the sorted chain.
+ */
+static free_block_s* sort_by_address (free_block_s* head) {
+
+  if (head == NULL || head->next == NULL) {
+    return head;
+  }
+
+  // Split the chain at its middle, sort each half, and merge the halves.
+  free_block_s* middle = head;
+  free_block_s* ahead  = head->next;
+  while (ahead != NULL && ahead->next != NULL) {
+    middle = middle->next;
+    ahead  = ahead->next->next;
+  }
+  free_block_s* second = sort_by_address(middle->next);
+  middle->next = NULL;
+  free_block_s* first = sort_by_address(head);
+
+  free_block_s  merged;
+  free_block_s* tail = &merged;
+  while (first != NULL && second != NULL) {
+    if (first < second) {
+      tail->next = first;
+      first      = first->next;
+    } else {
+      tail->next = second;
+      second     = second->next;
+    }
+    tail = tail->next;
+  }
+  tail->next = (first != NULL ? first : second);
+  return merged.next;
+
+} // sort_by_address ()
+
+/**
+ * Sweep the central list of one class.  A block seen there for the first time
+ * is marked as aged.  The blocks already aged are gathered, by address, into
+ * spans of neighbors, and the pages of each span past the link of its first
+ * block are purged, making that span a purged run.  Runs go to the end of the
+ * list, so that their pages are faulted in again only once every other block
+ * is taken.  Blocks in threads' caches, at most two batches of each class, are
+ * left alone.
+ *
+ * \param class The size class.
+ */
+static void sweep_class (int class) {
+
+  size_t          block_size = class_size(class);
+  central_list_s* central    = &central_lists[class];
+  free_block_s*   kept       = NULL;
+  free_block_s**  kept_end   = &kept;
+  free_block_s*   runs       = NULL;
+  free_block_s**  runs_end   = &runs;
+  free_block_s*   aged       = NULL;
+
+  // Sort the list into its purged runs, its aged blocks, and the rest, which
+  // become aged, too.
+  pthread_mutex_lock(&central->lock);
+  free_block_s* current = central->head;
+  while (current != NULL) {
+    free_block_s* next       = current->next;
+    header_s*     header_ptr = header_of(current);
+    if (header_ptr->size & RUN_BIT) {
+      *runs_end = current;
+      runs_end  = &current->next;
+    } else if (header_ptr->size & AGED_BIT) {
+      current->next = aged;
+      aged          = current;
+    } else {
+      header_ptr->size |= AGED_BIT;
+      *kept_end = current;
+      kept_end  = &current->next;
+    }
+    current = next;
+  }
+
+  // Purge each span of aged neighbors that holds a whole page; keep the rest.
+  aged = sort_by_address(aged);
+  while (aged != NULL) {
+    free_block_s* first = aged;
+    size_t        count = 1;
+    while (aged->next != NULL && (intptr_t)aged->next == (intptr_t)aged + (intptr_t)block_size) {
+      aged   = aged->next;
+      count += 1;
+    }
+    free_block_s* last = aged;
+    aged = aged->next;
+    if (purge_span((intptr_t)first + sizeof(free_block_s),
+		   (intptr_t)header_of(first) + count * block_size)) {
+      header_of(first)->size = block_size | RUN_BIT;
+      first->run             = count;
+      *runs_end              = first;
+      runs_end               = &first->next;
+    } else {
+      *kept_end = first;
+      kept_end  = &last->next;
+    }
+  }
+  *runs_end     = NULL;
+  *kept_end     = runs;
+  central->head = kept;
+  pthread_mutex_unlock(&central->lock);
+
+} // sweep_class ()
+
+/**
+ * Carve up to a batch of blocks from the end of the purged run at the front of
+ * a central list, taking the run off the list once it is used up.  Must be
+ * called with the list's lock held.
+ *
+ * \param central    The central list.
+ * \param block_size The block size of its class.
+ * \param batch      The most blocks to carve.
+ * \param taken      Set to the number of blocks carved.
+ * \return           The header of the first block carved.
+ */
+static intptr_t run_carve (central_list_s* central, size_t block_size, size_t batch, size_t* taken) {
+
+  free_block_s* run   = central->head;
+  size_t        count = (run->run < batch ? run->run : batch);
+  run->run -= count;
+  if (run->run == 0) {
+    central->head = run->next;
+  }
+  *taken = count;
+  return (intptr_t)header_of(run) + run->run * block_size;
+
+} // run_carve ()
+
+/**
+ * Sweep every central list, once each decay interval, for as long as the
+ * process runs.
+ *
+ * \param unused Unused.
+ * \return       Never returns.
+ */
+static void* sweep_loop (void* unused) {
+
+  struct timespec interval = { .tv_sec  = decay_ms / 1000,
+			       .tv_nsec = (decay_ms % 1000) * 1000000 };
+  while (true) {
+    nanosleep(&interval, NULL);
+    for (int class = 0; class < NUM_CLASSES; ++class) {
+      sweep_class(class);
+    }
+  }
+  return unused;
+
+} // sweep_loop ()
+
+/**
+ * Start the background sweep thread, unless purging is disabled, with every
+ * signal blocked, so that none is delivered to it in place of the program's own
+ * threads.  Must be called without the heap lock held, since creating a thread
+ * may allocate.
+ */
+static void sweep_start () {
+
+  pthread_mutex_lock(&heap_lock);
+  init();
+  bool enabled = (decay_ms > 0);
+  pthread_mutex_unlock(&heap_lock);
+  if (!enabled) {
+    return;
+  }
+
+  pthread_attr_t attr;
+  pthread_t      thread;
+  sigset_t       all;
+  sigset_t       old;
+  sigfillset(&all);
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  if (pthread_create(&thread, &attr, sweep_loop, NULL) == 0) {
+    pthread_setname_np(thread, "sf-sweep");
+  } else {
+    DEBUG("Could not start the sweep thread");
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  pthread_attr_destroy(&attr);
+
+} // sweep_start ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+// FORK HANDLERS
+
+/** Quiesce the heap before a `fork()`: take every lock. */
+static void fork_prepare () {
+
+  pthread_mutex_lock(&heap_lock);
+  for (int class = 0; class < NUM_CLASSES; ++class) {
+    pthread_mutex_lock(&central_lists[class].lock);
+  }
+
+} // fork_prepare ()
+
+/** Release every lock in the parent, once the `fork()` is done. */
+static void fork_parent () {
+
+  for (int class = NUM_CLASSES - 1; class >= 0; --class) {
+    pthread_mutex_unlock(&central_lists[class].lock);
+  }
+  pthread_mutex_unlock(&heap_lock);
+
+} // fork_parent ()
+
+/**
+ * Reset the heap in the child of a `fork()`, in which only the forking thread
+ * survives.  Abandon every other thread's heap, just as its thread would have
+ * on exit, except that its cached blocks stay in its caches, for its adopter.
+ * The sweep thread, like every other, did not survive the fork, so start
+ * another.
+ */
+static void fork_child () {
+
+  for (thread_heap_s* heap = all_heaps; heap != NULL; heap = heap->next_heap) {
+    if (heap->attached && heap != local_heap) {
+      heap->attached       = false;
+      heap->next_abandoned = abandoned_heaps;
+      abandoned_heaps      = heap;
+    }
+  }
+
+  trace_fork_child();
+  fork_parent();
+  sweep_start();
+
+} // fork_child ()
+
+/** Register the fork handlers, and start the sweep thread, as the library is loaded. */
+static void __attribute__ ((constructor)) fork_setup () {
+
+  pthread_atfork(fork_prepare, fork_parent, fork_child);
+  sweep_start();
+
+} // fork_setup ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a block too large for any size class in its own mapping.
+ *
+ * \param size The number of usable bytes requested.
+ * \return     The usable space of the new block, if successful; `NULL` if
+ *             unsuccessful.
+ */
+static void* large_malloc (size_t size) {
+
+  // The header goes just before the first aligned address in the mapping.
+  size_t length = (size + ALIGNMENT + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+  void*  map    = mmap(NULL,
+		       length,
+		       PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS,
+		       -1,
+		       0);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+
+  header_s* header_ptr = (header_s*)((intptr_t)map + ALIGNMENT - sizeof(header_s));
+  header_ptr->size = length;
+  return block_of(header_ptr);
+
+} // large_malloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a block aligned more strictly than `ALIGNMENT` in its own mapping,
+ * as a large block, since the blocks of a size class are aligned only to
+ * `ALIGNMENT`.  The mapping is over-sized for the alignment, and then trimmed to
+ * whole pages around the block, but kept larger than any size class, so that
+ * `free()` still knows it for a large block.  (Pages past the request are never
+ * touched, and so cost only address space.)
+ *
+ * \param alignment The alignment, a power of two.
+ * \param size      The number of usable bytes requested.
+ * \return          The usable space of the new block, if successful; `NULL` if
+ *                  unsuccessful.
+ */
+static void* large_memalign (size_t alignment, size_t size) {
+
+  size_t   page_size = PAGE_SIZE;
+  size_t   span      = (size > MAX_CLASS_SIZE ? size : MAX_CLASS_SIZE);
+  size_t   length    = (span + alignment + ALIGNMENT + page_size - 1) & ~(page_size - 1);
+  void*    map       = mmap(NULL,
+			    length,
+			    PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS,
+			    -1,
+			    0);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+
+  // Unmap the pages wholly before and after the block.
+  intptr_t map_addr = (intptr_t)map;
+  intptr_t usable   = (map_addr + ALIGNMENT + alignment - 1) & ~((intptr_t)alignment - 1);
+  intptr_t start    = usable - ALIGNMENT;
+  intptr_t first    = start & ~((intptr_t)page_size - 1);
+  intptr_t end      = (usable + span + page_size - 1) & ~((intptr_t)page_size - 1);
+  if (first > map_addr) {
+    munmap(map, first - map_addr);
+  }
+  if (end < map_addr + (intptr_t)length) {
+    munmap((void*)end, map_addr + length - end);
+  }
+
+  header_s* header_ptr = header_of((void*)usable);
+  header_ptr->size  = end - start;
+  header_ptr->owner = NULL;
+  return (void*)usable;
+
+} // large_memalign ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The slow path for allocation, taken when this thread's cache of a class is
+ * empty (or this thread has no heap yet).  First take back the blocks that
+ * other threads have freed to this one.  Failing those, refill the cache with
+ * a batch of blocks from the central list, or from the purged run at its front;
+ * if that list is empty, carve a new batch from the heap via _pointer bumping_.
+ * Then take the first block.
+ *
+ * \param class The size class.
+ * \return      A block of that class, if successful; `NULL` if the heap is
+ *              exhausted.
+ */
+static void* cache_refill (int class) {
+
+  thread_heap_s* heap = local_heap;
+  if (heap == NULL && (heap = heap_attach()) == NULL) {
+    return NULL;
+  }
+  cache_bin_s* bin = &heap->bins[class];
+  if (bin->limit == 0) {
+    cache_setup(heap, class);
+  }
+
+  remote_drain(heap);
+  if (bin->head != NULL) {
+    free_block_s* block = bin->head;
+    bin->head   = block->next;
+    bin->count -= 1;
+    header_of(block)->owner = heap;
+    return block;
+  }
+
+  size_t          batch      = batch_size(class);
+  size_t          block_size = class_size(class);
+  central_list_s* central    = &central_lists[class];
+
+  // Detach up to a batch from the front of the central list, short of its
+  // purged runs, forgetting the blocks' ages.  Failing any, carve a batch from
+  // the first run.
+  pthread_mutex_lock(&central->lock);
+  free_block_s* head  = central->head;
+  free_block_s* tail  = NULL;
+  size_t        taken = 0;
+  intptr_t      first = 0;
+  for (free_block_s* current = head;
+       current != NULL && taken < batch && !(header_of(current)->size & RUN_BIT);
+       current = current->next) {
+    header_of(current)->size = block_size;
+    tail   = current;
+    taken += 1;
+  }
+  if (tail != NULL) {
+    central->head = tail->next;
+    tail->next    = NULL;
+  } else if (head != NULL) {
+    first = run_carve(central, block_size, batch, &taken);
+  }
+  pthread_mutex_unlock(&central->lock);
+
+  // Otherwise, carve a new batch from the heap.  Class sizes are multiples of
+  // the alignment, so each block leaves the next one aligned, too.
+  if (taken == 0) {
+    pthread_mutex_lock(&heap_lock);
+    init();
+    size_t fit = (end_addr - free_addr) / block_size;
+    first      = free_addr;
+    taken      = (fit < batch ? fit : batch);
+    free_addr += taken * block_size;
+    pthread_mutex_unlock(&heap_lock);
+    if (taken == 0) {
+      return NULL;
+    }
+  }
+
+  // Write the header of each block carved from the heap or a run.
+  if (first != 0) {
+
+    head = NULL;
+    for (size_t i = taken; i > 0; --i) {
+      header_s*     header_ptr = (header_s*)(first + (i - 1) * block_size);
+      free_block_s* block_ptr  = (free_block_s*)block_of(header_ptr);
+      header_ptr->size = block_size;
+      block_ptr->next  = head;
+      head             = block_ptr;
+    }
+
+  }
+
+  bin->head  = head->next;
+  bin->count = taken - 1;
+  header_of(head)->owner = heap;
+  return head;
+
+} // cache_refill ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The slow path for deallocation, taken when this thread's cache of a class
+ * grows past its limit (or has none yet).  Take back the blocks that other
+ * threads have freed to this one, and trim the cache.
+ *
+ * \param class The size class.
+ */
+static void cache_flush (int class) {
+
+  remote_drain(local_heap);
+  cache_trim(local_heap, class);
+
+} // cache_flush ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate and return `size` bytes of heap space.  Pop a block from this
+ * thread's cache of the matching size class, refilling the cache if it is
+ * empty.
+ *
+ * \param size The number of bytes to allocate.
+ * \return A pointer to the allocated block, if successful; `NULL` if
+ *         unsuccessful.
+ */
+static void* allocate (size_t size) {
+
+  if (size == 0) {
+    return NULL;
+  }
+  if (size > MAX_CLASS_SIZE - sizeof(header_s)) {
+    return (size > HEAP_SIZE ? NULL : large_malloc(size));
+  }
+
+  int            class = size_class(size + sizeof(header_s));
+  thread_heap_s* heap  = local_heap;
+  if (heap != NULL) {
+    cache_bin_s*  bin      = &heap->bins[class];
+    free_block_s* free_ptr = bin->head;
+    if (free_ptr != NULL) {
+      bin->head   = free_ptr->next;
+      bin->count -= 1;
+      header_of(free_ptr)->owner = heap;
+      return free_ptr;
+    }
+  }
+  return cache_refill(class);
+
+} // allocate ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate and return `size` bytes of heap space.
+ *
+ * \param size The number of bytes to allocate.
+ * \return A pointer to the allocated block, if successful; `NULL` if
+ *         unsuccessful.
+ */
+void* malloc (size_t size) {
+
+  void* block_ptr = allocate(size);
+  TRACE(TRACE_MALLOC, block_ptr, size, 0);
+  return block_ptr;
+
+} // malloc()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Deallocate a given block on the heap.  Push the given block (if any) onto
+ * this thread's cache of its size class, flushing the cache if it grows too
+ * full, or unmap it if it is a large block.  A block allocated by another
+ * thread goes instead onto that thread's remote-free queue.
+ *
+ * \param ptr A pointer to the block to be deallocated.
+ */
+static void deallocate (void* ptr) {
+
+  if (ptr == NULL) {
+    return;
+  }
+
+  header_s* header_ptr = header_of(ptr);
+  size_t    size       = header_ptr->size;
+  if (size > MAX_CLASS_SIZE) {
+    intptr_t start = (intptr_t)ptr - ALIGNMENT;
+    intptr_t first = start & ~((intptr_t)PAGE_SIZE - 1);
+    munmap((void*)first, start + size - first);
+    return;
+  }
+
+  int class = size_class(size);
+  if (size == 0 || class_size(class) != size) {
+    ERROR("free(): not a block from this heap: ", (intptr_t)ptr);
+  }
+
+  free_block_s*  free_ptr = (free_block_s*)ptr;
+  thread_heap_s* owner    = header_ptr->owner;
+  if (owner != local_heap) {
+    remote_free(owner, free_ptr);
+    return;
+  }
+
+  cache_bin_s* bin = &owner->bins[class];
+  free_ptr->next = bin->head;
+  bin->head      = free_ptr;
+  bin->count    += 1;
+  if (bin->count > bin->limit) {
+    cache_flush(class);
+  }
+
+} // deallocate ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Deallocate a given block on the heap.
+ *
+ * \param ptr A pointer to the block to be deallocated.
+ */
+void free (void* ptr) {
+
+  DEBUG("free(): ", (intptr_t)ptr);
+
+  TRACE(TRACE_FREE, ptr, 0, 0);
+  deallocate(ptr);
+
+} // free()
+// ==============================================================================
+
+
+// ==============================================================================
+/**
+ * Deallocate a block whose size is known, as C23's `free_sized()`.  The size
+ * cannot pick the free list by itself: the header must be read anyway, to find
+ * the block's owner, and `realloc()` may have shrunk the block in place, so
+ * that the size no longer names its class.
+ *
+ * \param ptr  A pointer to the block to be deallocated.
+ * \param size The size requested when the block was allocated.
+ */
+void free_sized (void* ptr, size_t size) {
+
+  TRACE(TRACE_FREE, ptr, size, 0);
+  deallocate(ptr);
+
+} // free_sized ()
+
+/**
+ * Deallocate an aligned block whose size is known, as C23's
+ * `free_aligned_sized()`.
+ *
+ * \param ptr       A pointer to the block to be deallocated.
+ * \param alignment The alignment requested when the block was allocated.
+ * \param size      The size requested when the block was allocated.
+ */
+void free_aligned_sized (void* ptr, size_t alignment, size_t size) {
+
+  TRACE(TRACE_FREE, ptr, size, alignment);
+  deallocate(ptr);
+
+} // free_aligned_sized ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `count` blocks of `size` bytes each.  Take each run of blocks that
+ * this thread's cache of their class holds in one pass down the cache, and
+ * refill the cache (a batch at a time) only once it runs dry.
+ *
+ * \param size  The number of bytes in each block.
+ * \param count The number of blocks to allocate.
+ * \param out   Filled with the blocks, in order.
+ * \return      The number of blocks allocated.
+ */
+size_t pb_malloc_batch (size_t size, size_t count, void** out) {
+
+  size_t done = 0;
+
+  if (size == 0 || size > MAX_CLASS_SIZE - sizeof(header_s)) {
+
+    for (; done < count; ++done) {
+      if ((out[done] = allocate(size)) == NULL) {
+	break;
+      }
+    }
+
+  } else {
+
+    int class = size_class(size + sizeof(header_s));
+    while (done < count) {
+      thread_heap_s* heap  = local_heap;
+      free_block_s*  block = (heap != NULL ? heap->bins[class].head : NULL);
+      if (block == NULL) {
+	if ((out[done] = cache_refill(class)) == NULL) {
+	  break;
+	}
+	done += 1;
+	continue;
+      }
+      cache_bin_s* bin   = &heap->bins[class];
+      size_t       taken = 0;
+      for (; block != NULL && done < count; block = block->next) {
+	header_of(block)->owner = heap;
+	out[done++]             = block;
+	taken                  += 1;
+      }
+      bin->head   = block;
+      bin->count -= taken;
+    }
+
+  }
+
+  if (__builtin_expect(trace_state != TRACE_OFF, false)) {
+    for (size_t i = 0; i < done; ++i) {
+      TRACE(TRACE_MALLOC, out[i], size, 0);
+    }
+  }
+  return done;
+
+} // pb_malloc_batch ()
+
+/**
+ * Push a chain of freed blocks onto this thread's cache of their class,
+ * flushing the cache if it grows too full.
+ *
+ * \param heap  This thread's heap.
+ * \param class The size class.
+ * \param head  The first block of the chain.
+ * \param tail  The last block of the chain.
+ * \param count The number of blocks in the chain.
+ */
+static void cache_push (thread_heap_s* heap,
+			int            class,
+			free_block_s*  head,
+			free_block_s*  tail,
+			size_t         count) {
+
+  cache_bin_s* bin = &heap->bins[class];
+  tail->next  = bin->head;
+  bin->head   = head;
+  bin->count += count;
+  if (bin->count > bin->limit) {
+    cache_flush(class);
+  }
+
+} // cache_push ()
+
+/**
+ * Deallocate `count` blocks, from last to first.  Each run of blocks of one
+ * class owned by this thread is linked into a chain, and the chain is pushed
+ * onto this thread's cache of that class at once, trimming the cache only
+ * then.  Any other block is freed on its own.
+ *
+ * \param ptrs  The blocks.
+ * \param count The number of blocks.
+ */
+void pb_free_batch (void** ptrs, size_t count) {
+
+  thread_heap_s* heap  = local_heap;
+  free_block_s*  head  = NULL;
+  free_block_s*  tail  = NULL;
+  size_t         run   = 0;
+  size_t         limit = 0;
+  int            class = 0;
+
+  for (size_t i = count; i > 0; --i) {
+
+    void* ptr = ptrs[i - 1];
+    TRACE(TRACE_FREE, ptr, 0, 0);
+    if (ptr == NULL) {
+      continue;
+    }
+    header_s* header_ptr = header_of(ptr);
+    if (heap == NULL || header_ptr->owner != heap) {
+      deallocate(ptr);
+      continue;
+    }
+
+    // Push the chain so far before starting one of another class.  A chain is
+    // kept to a batch, too, so that trimming never walks more than the cache
+    // would hold anyway.
+    int block_class = size_class(header_ptr->size);
+    if (run > 0 && block_class != class) {
+      cache_push(heap, class, head, tail, run);
+      run = 0;
+    }
+    if (class_size(block_class) != header_ptr->size) {
+      ERROR("free(): not a block from this heap: ", (intptr_t)ptr);
+    }
+
+    free_block_s* block = (free_block_s*)ptr;
+    if (run == 0) {
+      tail  = block;
+      class = block_class;
+      limit = batch_size(class);
+    }
+    block->next = (run > 0 ? head : NULL);
+    head        = block;
+    run        += 1;
+    if (run == limit) {
+      cache_push(heap, class, head, tail, run);
+      run = 0;
+    }
+
+  }
+
+  if (run > 0) {
+    cache_push(heap, class, head, tail, run);
+  }
+
+} // pb_free_batch ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a block of `nmemb * size` bytes on the heap, zeroing its contents.
+ *
+ * \param nmemb The number of elements in the new block.
+ * \param size  The size, in bytes, of each of the `nmemb` elements.
+ * \return      A pointer to the newly allocated and zeroed block, if successful;
+ *              `NULL` if unsuccessful.
+ */
+void* calloc (size_t nmemb, size_t size) {
+
+  // Refuse requests whose total size overflows.
+  size_t block_size;
+  if (__builtin_mul_overflow(nmemb, size, &block_size)) {
+    return NULL;
+  }
+
+  // Allocate a block of the requested size.
+  void* block_ptr = allocate(block_size);
+
+  // If the allocation succeeded, clear the entire block.
+  if (block_ptr != NULL) {
+    memset(block_ptr, 0, block_size);
+  }
+
+  TRACE(TRACE_CALLOC, block_ptr, block_size, nmemb);
+  return block_ptr;
+
+} // calloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `size` bytes, aligned to `alignment`.  Every block is aligned to
+ * `ALIGNMENT`; any stricter alignment gets a mapping of its own.
+ *
+ * \param alignment The alignment, a power of two.
+ * \param size      The number of bytes to allocate.
+ * \return          A pointer to the allocated block, if successful; `NULL` if
+ *                  unsuccessful.
+ */
+static void* aligned_allocate (size_t alignment, size_t size) {
+
+  if (alignment <= ALIGNMENT) {
+    return allocate(size);
+  }
+  if (size == 0 || size > HEAP_SIZE || alignment > HEAP_SIZE) {
+    return NULL;
+  }
+  return large_memalign(alignment, size);
+
+} // aligned_allocate ()
+// ==============================================================================
+
+
+// ==============================================================================
+/**
+ * Allocate `size` bytes, aligned to `alignment`.
+ *
+ * \param memptr    Set to the allocated block, if successful.
+ * \param alignment The alignment, a power of two and a multiple of
+ *                  `sizeof(void*)`.
+ * \param size      The number of bytes to allocate.
+ * \return          `0` if successful; `EINVAL` if the alignment is invalid;
+ *                  `ENOMEM` if the block could not be allocated.
+ */
+int posix_memalign (void** memptr, size_t alignment, size_t size) {
+
+  if (!IS_POWER_OF_TWO(alignment) || alignment % sizeof(void*) != 0) {
+    return EINVAL;
+  }
+  void* block_ptr = aligned_allocate(alignment, size);
+  TRACE(TRACE_MEMALIGN, block_ptr, size, alignment);
+  if (block_ptr == NULL && size != 0) {
+    return ENOMEM;
+  }
+  *memptr = block_ptr;
+  return 0;
+
+} // posix_memalign ()
+
+/**
+ * Allocate `size` bytes, aligned to `alignment`.
+ *
+ * \param alignment The alignment, a power of two.
+ * \param size      The number of bytes to allocate.
+ * \return          A pointer to the allocated block, if successful; `NULL` if
+ *                  unsuccessful.
+ */
+void* aligned_alloc (size_t alignment, size_t size) {
+
+  if (!IS_POWER_OF_TWO(alignment)) {
+    errno = EINVAL;
+    return NULL;
+  }
+  void* block_ptr = aligned_allocate(alignment, size);
+  TRACE(TRACE_MEMALIGN, block_ptr, size, alignment);
+  return block_ptr;
+
+} // aligned_alloc ()
+
+/**
+ * Allocate `size` bytes, aligned to `alignment`, which (as in glibc) is rounded
+ * up to a power of two if it is not one.
+ *
+ * \param alignment The alignment.
+ * \param size      The number of bytes to allocate.
+ * \return          A pointer to the allocated block, if successful; `NULL` if
+ *                  unsuccessful.
+ */
+void* memalign (size_t alignment, size_t size) {
+
+  size_t power = ALIGNMENT;
+  while (power < alignment && power <= HEAP_SIZE) {
+    power <<= 1;
+  }
+  void* block_ptr = aligned_allocate(power, size);
+  TRACE(TRACE_MEMALIGN, block_ptr, size, power);
+  return block_ptr;
+
+} // memalign ()
+
+/**
+ * Allocate `size` bytes, aligned to a page.
+ *
+ * \param size The number of bytes to allocate.
+ * \return     A pointer to the allocated block, if successful; `NULL` if
+ *             unsuccessful.
+ */
+void* valloc (size_t size) {
+  return memalign(PAGE_SIZE, size);
+} // valloc ()
+
+/**
+ * Allocate `size` bytes, rounded up to a whole number of pages, and aligned to
+ * a page.
+ *
+ * \param size The number of bytes to allocate.
+ * \return     A pointer to the allocated block, if successful; `NULL` if
+ *             unsuccessful.
+ */
+void* pvalloc (size_t size) {
+
+  size_t page_size = PAGE_SIZE;
+  if (size > HEAP_SIZE) {
+    return NULL;
+  }
+  return memalign(page_size, (size + page_size - 1) & ~(page_size - 1));
+
+} // pvalloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Update the given block at `ptr` to take on the given `size`.  Here, if `size`
+ * fits within the given block's size class, then the block is returned
+ * unchanged.  Otherwise, a new and larger block is allocated, and the data from
+ * the old block is copied, the old block freed, and the new block returned.
+ *
+ * \param ptr  The block to be assigned a new size.
+ * \param size The new size that the block should assume.
+ * \return     A pointer to the resultant block, which may be `ptr` itself, or
+ *             may be a newly allocated block.
+ */
+static void* reallocate (void* ptr, size_t size) {
+
+  if (ptr == NULL) {
+    return allocate(size);
+  }
+
+  if (size == 0) {
+    deallocate(ptr);
+    return NULL;
+  }
+
+  size_t old_size = usable_size(header_of(ptr));
+  if (size <= old_size) {
+    return ptr;
+  }
+
+  void* new_ptr = allocate(size);
+  if (new_ptr != NULL) {
+    memcpy(new_ptr, ptr, old_size);
+    deallocate(ptr);
+  }
+  return new_ptr;
+
+} // reallocate ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Update the given block at `ptr` to take on the given `size`.
+ *
+ * \param ptr  The block to be assigned a new size.
+ * \param size The new size that the block should assume.
+ * \return     A pointer to the resultant block, which may be `ptr` itself, or
+ *             may be a newly allocated block.
+ */
+void* realloc (void* ptr, size_t size) {
+
+  void* new_ptr = reallocate(ptr, size);
+  TRACE(TRACE_REALLOC, new_ptr, size, (uintptr_t)ptr);
+  return new_ptr;
+
+} // realloc()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The number of usable bytes in a block, which may be more than were requested.
+ * Exported, so that glibc's version never reads a header of this heap.
+ *
+ * \param ptr The block.
+ * \return    The block's size; `0` if `ptr` is `NULL`.
+ */
+size_t malloc_usable_size (void* ptr) {
+  return (ptr == NULL ? 0 : usable_size(header_of(ptr)));
+} // malloc_usable_size ()
+// ==============================================================================
+
+
+
+#if defined (ALLOC_MAIN)
+// ==============================================================================
+/**
+ * The entry point if this code is compiled as a standalone program for testing
+ * purposes.
+ */
+int main () {
+
+  // Allocate a few blocks, then free them.
+  void* x = malloc(16);
+  void* y = malloc(64);
+  void* z = malloc(32);
+
+  free(z);
+  free(y);
+  free(x);
+
+  return 0;
+
+} // main()
+// ==============================================================================
+#endif
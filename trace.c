@@ -0,0 +1,292 @@
+// ==============================================================================
+/**
+ * trace.c
+ *
+ * A binary trace of heap operations, kept in a lock-free ring buffer mapped
+ * from a file.  Like the safe I/O functions, nothing here relies on heap
+ * allocation.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS AND FUNCTIONS
+
+/** The environment variables that configure tracing. */
+#define TRACE_ENV         "PB_TRACE"
+#define TRACE_RECORDS_ENV "PB_TRACE_RECORDS"
+#define TRACE_MODE_ENV    "PB_TRACE_MODE"
+
+/** The default, and the least, number of records in the ring. */
+#define TRACE_DEFAULT_RECORDS (1 << 20)
+#define TRACE_MIN_RECORDS     (1 << 10)
+
+/**
+ * The number of slots that each thread claims at once, so that threads touch
+ * the shared head only once per batch.
+ */
+#define TRACE_BATCH 64
+
+/** The state of tracing while one thread sets it up. */
+#define TRACE_INITIALIZING 2
+
+/** Thread-local storage, as in the allocators. */
+#define THREAD_LOCAL __thread __attribute__ ((tls_model ("initial-exec")))
+// ==============================================================================
+
+
+
+// ==============================================================================
+// GLOBALS
+
+int trace_state = TRACE_UNINITIALIZED;
+
+/** The header of the mapped trace file, and the ring that follows it. */
+static trace_header_s* trace_header = NULL;
+static trace_record_s* trace_ring   = NULL;
+
+/** Whether records are dropped, rather than overwriting others, once full. */
+static bool trace_recording = false;
+
+/** The next slot that this thread will fill, and the end of its batch. */
+static THREAD_LOCAL uint64_t trace_next  = 0;
+static THREAD_LOCAL uint64_t trace_limit = 0;
+
+/** This thread's ID, once looked up. */
+static THREAD_LOCAL uint32_t trace_tid = 0;
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Read the time stamp counter, where there is one.
+ *
+ * \return The current time stamp.
+ */
+static inline uint64_t timestamp () {
+
+#if defined (__x86_64__) || defined (__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+
+} // timestamp ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Name the trace file of this process: the path given by `PB_TRACE`, followed
+ * by a dot and the process ID.  Built without allocating.
+ *
+ * \param name   The buffer for the name.
+ * \param length The length of the buffer.
+ * \param path   The path given by `PB_TRACE`.
+ * \return       `true` if the name fits; `false` if it does not.
+ */
+static bool trace_name (char* name, size_t length, const char* path) {
+
+  char     digits[24];
+  char*    current = digits + sizeof(digits);
+  uint64_t pid     = (uint64_t)getpid();
+  do {
+    *--current = '0' + pid % 10;
+    pid       /= 10;
+  } while (pid != 0);
+  size_t path_length  = strlen(path);
+  size_t digit_length = digits + sizeof(digits) - current;
+  if (path_length + 1 + digit_length + 1 > length) {
+    return false;
+  }
+  memcpy(name, path, path_length);
+  name[path_length] = '.';
+  memcpy(name + path_length + 1, current, digit_length);
+  name[path_length + 1 + digit_length] = '\0';
+  return true;
+
+} // trace_name ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Map the trace file and write its header, if tracing is requested.  Each
+ * process names its own file, so that a program run by this one (through
+ * `system()`, say) inheriting `PB_TRACE` never truncates this one's live ring.
+ *
+ * \return `TRACE_ON` if successful; `TRACE_OFF` if tracing is not requested, or
+ *         the file could not be mapped.
+ */
+static int trace_map () {
+
+  const char* path = getenv(TRACE_ENV);
+  char        name[PATH_MAX];
+  if (path == NULL || !trace_name(name, sizeof(name), path)) {
+    return TRACE_OFF;
+  }
+
+  // Round the capacity up to a power of two, so that slots map to records by
+  // masking.
+  uint64_t    capacity = TRACE_MIN_RECORDS;
+  const char* records  = getenv(TRACE_RECORDS_ENV);
+  uint64_t    wanted   = (records != NULL ?
+			  strtoull(records, NULL, 10) :
+			  TRACE_DEFAULT_RECORDS);
+  while (capacity < wanted && capacity < (UINT64_C(1) << 40)) {
+    capacity <<= 1;
+  }
+
+  size_t length = sizeof(trace_header_s) + capacity * sizeof(trace_record_s);
+  int    fd     = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return TRACE_OFF;
+  }
+  if (ftruncate(fd, length) != 0) {
+    close(fd);
+    return TRACE_OFF;
+  }
+  void* map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return TRACE_OFF;
+  }
+
+  trace_header              = (trace_header_s*)map;
+  trace_ring                = (trace_record_s*)(trace_header + 1);
+  trace_header->version     = TRACE_VERSION;
+  trace_header->record_size = sizeof(trace_record_s);
+  trace_header->capacity    = capacity;
+  trace_header->head        = 0;
+  trace_header->dropped     = 0;
+  trace_header->flags       = 0;
+  const char* mode = getenv(TRACE_MODE_ENV);
+  if (mode != NULL && strcmp(mode, "record") == 0) {
+    trace_recording      = true;
+    trace_header->flags |= TRACE_FLAG_RECORD;
+  }
+  trace_header->magic       = TRACE_MAGIC;
+  return TRACE_ON;
+
+} // trace_map ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Set up tracing, if no thread has yet.  Exactly one thread maps the file;
+ * any others that race with it wait until it is done.
+ */
+static void trace_init () {
+
+  int expected = TRACE_UNINITIALIZED;
+  if (__atomic_compare_exchange_n(&trace_state,
+				  &expected,
+				  TRACE_INITIALIZING,
+				  false,
+				  __ATOMIC_ACQUIRE,
+				  __ATOMIC_ACQUIRE)) {
+    __atomic_store_n(&trace_state, trace_map(), __ATOMIC_RELEASE);
+    return;
+  }
+
+  while (__atomic_load_n(&trace_state, __ATOMIC_ACQUIRE) == TRACE_INITIALIZING) {
+    sched_yield();
+  }
+
+} // trace_init ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Append a record to the trace.  The record's sequence number is written last,
+ * so that a decoder can tell a finished record from one still being written
+ * (or from one overwritten by a later pass around the ring).  In record mode,
+ * a record past the end of the ring is dropped instead.
+ *
+ * \param op   The operation.
+ * \param ptr  The block.
+ * \param size The size requested.
+ * \param aux  The second operand.
+ */
+void trace_event (uint16_t op, uint64_t ptr, uint64_t size, uint64_t aux) {
+
+  if (__atomic_load_n(&trace_state, __ATOMIC_ACQUIRE) != TRACE_ON) {
+    trace_init();
+    if (__atomic_load_n(&trace_state, __ATOMIC_ACQUIRE) != TRACE_ON) {
+      return;
+    }
+  }
+
+  // Claim a new batch of slots, if this thread's is used up.
+  if (trace_next == trace_limit) {
+    trace_next  = __atomic_fetch_add(&trace_header->head, TRACE_BATCH, __ATOMIC_RELAXED);
+    trace_limit = trace_next + TRACE_BATCH;
+    if (trace_tid == 0) {
+      trace_tid = (uint32_t)syscall(SYS_gettid);
+    }
+  }
+
+  uint64_t slot = trace_next++;
+  if (trace_recording && slot >= trace_header->capacity) {
+    __atomic_fetch_add(&trace_header->dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  trace_record_s* record = &trace_ring[slot & (trace_header->capacity - 1)];
+  __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+  record->tsc  = timestamp();
+  record->ptr  = ptr;
+  record->size = size;
+  record->aux  = aux;
+  record->tid  = trace_tid;
+  record->op   = op;
+  __atomic_store_n(&record->seq, slot + 1, __ATOMIC_RELEASE);
+
+} // trace_event ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Forget this thread's claimed slots and thread id, in the child of a `fork()`,
+ * so that the child never writes into slots that its parent still owns.
+ */
+void trace_fork_child () {
+
+  trace_next  = 0;
+  trace_limit = 0;
+  trace_tid   = 0;
+
+} // trace_fork_child ()
+// ==============================================================================
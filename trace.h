@@ -0,0 +1,192 @@
+// ==============================================================================
+/**
+ * trace.h
+ *
+ * A binary trace of heap operations, cheap enough to leave on under load.  Each
+ * thread appends fixed-size records to a ring buffer in a shared mapping of a
+ * file, claiming slots in batches with a single atomic addition, and never
+ * making a system call or taking a lock on the way.  Since the ring is the file
+ * itself, the trace survives even if the process crashes; `tracedump` decodes
+ * it.
+ *
+ * Tracing is turned on by setting the `PB_TRACE` environment variable to the
+ * path of the file, and `PB_TRACE_RECORDS` to the number of records in the
+ * ring, which is rounded up to a power of two.  Once the ring fills, new
+ * records overwrite the oldest.
+ *
+ * Each process writes its own file, named by suffixing the path with a dot and
+ * its process ID (`trace.1234`), so that programs it runs, which inherit
+ * `PB_TRACE`, trace to files of their own rather than truncating its ring.  A
+ * child of `fork()` that does not `exec()` keeps writing to its parent's file.
+ *
+ * Setting `PB_TRACE_MODE` to `record` instead keeps every record from the
+ * start, for `replay` to drive an allocator through the same calls: once the
+ * ring fills, new records are dropped (and counted), rather than overwriting
+ * old ones.  The file is sparse, so a large ring costs only what is written.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// Avoid multiple inclusion.
+
+#if !defined (_TRACE_H)
+#define _TRACE_H
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <stdbool.h>
+#include <stdint.h>
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACROS
+
+/** The magic number at the start of every trace file, and its format version. */
+#define TRACE_MAGIC   UINT64_C(0x6563617274627021)
+#define TRACE_VERSION 2
+
+/** The operations that are traced. */
+#define TRACE_MALLOC   1
+#define TRACE_CALLOC   2
+#define TRACE_REALLOC  3
+#define TRACE_FREE     4
+#define TRACE_MEMALIGN 5
+
+/** A header flag marking a trace kept in record mode. */
+#define TRACE_FLAG_RECORD 0x1
+
+/** The states of tracing: not yet configured, off, or on. */
+#define TRACE_UNINITIALIZED -1
+#define TRACE_OFF            0
+#define TRACE_ON             1
+
+/**
+ * Trace an operation.  When tracing is off, this costs just one well-predicted
+ * branch.
+ *
+ * \param op   The operation.
+ * \param ptr  The block that resulted (or, for `free()`, was freed).
+ * \param size The size requested (or, for `free()`, the size given to
+ *             `free_sized()`, if any).
+ * \param aux  A second operand: the original block, for `realloc()`; the
+ *             element count, for `calloc()`; the alignment, for the aligned
+ *             allocation functions and `free_aligned_sized()`.
+ */
+#define TRACE(op,ptr,size,aux)						\
+  do {									\
+    if (__builtin_expect(trace_state != TRACE_OFF, false)) {		\
+      trace_event((op), (uint64_t)(uintptr_t)(ptr), (size), (aux));	\
+    }									\
+  } while (0)
+// ==============================================================================
+
+
+
+// ==============================================================================
+// TYPES AND STRUCTURES
+
+/** The header at the start of a trace file, followed by the ring of records. */
+typedef struct trace_header {
+
+  /** `TRACE_MAGIC`, and then `TRACE_VERSION`. */
+  uint64_t magic;
+  uint32_t version;
+
+  /** The size of each record, in bytes. */
+  uint32_t record_size;
+
+  /** The number of records in the ring, a power of two. */
+  uint64_t capacity;
+
+  /**
+   * The number of slots ever claimed.  Slot `i` lives in record `i %
+   * capacity`; claimed slots that were never written are left as they were.
+   */
+  uint64_t head;
+
+  /** The number of records dropped, in record mode, once the ring was full. */
+  uint64_t dropped;
+
+  /** Flags recording how the trace was kept. */
+  uint32_t flags;
+
+  char padding[20];
+
+} trace_header_s;
+
+/** A record of one operation. */
+typedef struct trace_record {
+
+  /**
+   * One more than the number of the slot that holds this record, written last;
+   * zero if the record has never been written.
+   */
+  uint64_t seq;
+
+  /** The time stamp counter (or, without one, nanoseconds) at the operation. */
+  uint64_t tsc;
+
+  /** The operands of the operation (see `TRACE()`). */
+  uint64_t ptr;
+  uint64_t size;
+  uint64_t aux;
+
+  /** The thread that performed the operation. */
+  uint32_t tid;
+
+  /** The operation. */
+  uint16_t op;
+
+  uint16_t padding;
+
+} trace_record_s;
+// ==============================================================================
+
+
+
+// ==============================================================================
+// GLOBALS
+
+/**
+ * Whether tracing is on; tested by `TRACE()` on every operation.  Hidden, so
+ * that each library reads its own copy directly, and not through its GOT.
+ */
+extern int trace_state __attribute__ ((visibility ("hidden")));
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Append a record to the trace, first setting up the trace if this is its
+ * first use.  Called only by `TRACE()`.
+ *
+ * \param op   The operation.
+ * \param ptr  The block.
+ * \param size The size requested.
+ * \param aux  The second operand.
+ */
+void trace_event (uint16_t op, uint64_t ptr, uint64_t size, uint64_t aux)
+  __attribute__ ((visibility ("hidden")));
+
+/**
+ * Forget the calling thread's claimed slots and thread id, in the child of a
+ * `fork()`.  The child shares the trace file with its parent, and so must
+ * claim slots of its own.  Called by each allocator's child fork handler.
+ */
+void trace_fork_child (void) __attribute__ ((visibility ("hidden")));
+// ==============================================================================
+
+
+
+// ==============================================================================
+#endif // _TRACE_H
+// ==============================================================================
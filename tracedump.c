@@ -0,0 +1,179 @@
+// ==============================================================================
+/**
+ * tracedump.c
+ *
+ * Decode a trace file written by the allocators' `TRACE()`.  Prints each
+ * finished record, in time stamp order, as a line of tab-separated fields:
+ *
+ *     seq  tsc  tid  op  ptr  size  aux
+ *
+ * where `tsc` is relative to the first record.  With `-s`, prints only a
+ * summary of the operations traced.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS AND FUNCTIONS
+
+/** One more than the largest operation code. */
+#define TRACE_OPS 6
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The name of an operation.
+ *
+ * \param op The operation.
+ * \return   Its name.
+ */
+static const char* op_name (uint16_t op) {
+
+  switch (op) {
+  case TRACE_MALLOC:   return "malloc";
+  case TRACE_CALLOC:   return "calloc";
+  case TRACE_REALLOC:  return "realloc";
+  case TRACE_FREE:     return "free";
+  case TRACE_MEMALIGN: return "memalign";
+  default:             return "?";
+  }
+
+} // op_name ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/** Order records by time stamp, and then by slot. */
+static int by_time (const void* a, const void* b) {
+
+  const trace_record_s* x = *(const trace_record_s* const*)a;
+  const trace_record_s* y = *(const trace_record_s* const*)b;
+  if (x->tsc != y->tsc) {
+    return (x->tsc < y->tsc ? -1 : 1);
+  }
+  return (x->seq < y->seq ? -1 : (x->seq > y->seq ? 1 : 0));
+
+} // by_time ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Decode a trace file.
+ *
+ * \param argc The number of arguments.
+ * \param argv The arguments: an optional `-s`, and then the trace file.
+ * \return     `0` if successful; `1` if the file could not be decoded.
+ */
+int main (int argc, char** argv) {
+
+  int summary = (argc == 3 && strcmp(argv[1], "-s") == 0);
+  if (argc != 2 + summary) {
+    fprintf(stderr, "USAGE: %s [-s] <trace file>\n", argv[0]);
+    return 1;
+  }
+  const char* path = argv[1 + summary];
+
+  // Map the whole file, and check that it is a trace.
+  int         fd = open(path, O_RDONLY);
+  struct stat info;
+  if (fd < 0 || fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(trace_header_s)) {
+    fprintf(stderr, "%s: cannot read %s\n", argv[0], path);
+    return 1;
+  }
+  void* map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+  const trace_header_s* header = (const trace_header_s*)map;
+  if (header->magic != TRACE_MAGIC ||
+      header->version != TRACE_VERSION ||
+      header->record_size != sizeof(trace_record_s) ||
+      (size_t)info.st_size < sizeof(trace_header_s) + header->capacity * sizeof(trace_record_s)) {
+    fprintf(stderr, "%s: %s is not a trace file\n", argv[0], path);
+    return 1;
+  }
+  const trace_record_s* ring = (const trace_record_s*)(header + 1);
+
+  // Gather every finished record, from the slots that may still be in the
+  // ring.  A record belongs to a slot only if it carries that slot's number.
+  // In record mode, the ring holds just the first slots.
+  bool     record = (header->flags & TRACE_FLAG_RECORD) != 0;
+  uint64_t head   = header->head;
+  uint64_t first  = (head > header->capacity && !record ? head - header->capacity : 0);
+  if (record && head > header->capacity) {
+    head = header->capacity;
+  }
+  const trace_record_s** records = malloc((head - first + 1) * sizeof(*records));
+  if (records == NULL) {
+    perror("malloc");
+    return 1;
+  }
+  size_t count = 0;
+  for (uint64_t slot = first; slot < head; ++slot) {
+    const trace_record_s* record = &ring[slot & (header->capacity - 1)];
+    if (record->seq == slot + 1) {
+      records[count++] = record;
+    }
+  }
+  qsort(records, count, sizeof(*records), by_time);
+
+  if (summary) {
+    uint64_t calls[TRACE_OPS] = { 0 };
+    uint64_t bytes[TRACE_OPS] = { 0 };
+    for (size_t i = 0; i < count; ++i) {
+      uint16_t op = (records[i]->op < TRACE_OPS ? records[i]->op : 0);
+      calls[op] += 1;
+      bytes[op] += records[i]->size;
+    }
+    printf("records:\t%zu of %" PRIu64 " claimed (%" PRIu64 " overwritten, %" PRIu64 " dropped)\n",
+	   count, header->head, first, header->dropped);
+    for (uint16_t op = 1; op < TRACE_OPS; ++op) {
+      printf("%s:\t%" PRIu64 " calls\t%" PRIu64 " bytes\n", op_name(op), calls[op], bytes[op]);
+    }
+    if (count > 0) {
+      printf("ticks:\t%" PRIu64 "\n", records[count - 1]->tsc - records[0]->tsc);
+    }
+    return 0;
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    const trace_record_s* record = records[i];
+    printf("%" PRIu64 "\t%" PRIu64 "\t%" PRIu32 "\t%s\t0x%" PRIx64 "\t%" PRIu64 "\t0x%" PRIx64 "\n",
+	   record->seq - 1,
+	   record->tsc - records[0]->tsc,
+	   record->tid,
+	   op_name(record->op),
+	   record->ptr,
+	   record->size,
+	   record->aux);
+  }
+  return 0;
+
+} // main ()
+// ==============================================================================